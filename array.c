@@ -1,75 +1,106 @@
 ﻿#include "linear_sequence.h"
+#include "lsq_stats.h"
+#include "lsq_parallel.h"
+#include "lsq_arena.h"
 #include <string.h>
 
-#define CONTAINER_INITIAL_SIZE 10;
+#define CONTAINER_INITIAL_SIZE 10
 
 typedef struct {
 	LSQ_BaseTypeT* data;
 	int physical_size;
 	int logical_size;
+	LSQ_ArenaT arena;
 }	ArrayT, *ArrayPtrT;
 
 
 typedef struct {
 	ArrayPtrT handle;
 	LSQ_IntegerIndexT index;
+	LSQ_ArenaT arena;
 }	IteratorT, *IteratorPtrT;
 
 static LSQ_IteratorT CreateIterator(LSQ_HandleT h, LSQ_IntegerIndexT index){
 	IteratorPtrT iter = NULL;
 	if (h == LSQ_HandleInvalid)
 		return LSQ_HandleInvalid;
-	iter = (IteratorPtrT) malloc(sizeof(IteratorT));
+	iter = (IteratorPtrT) LSQ_ArenaMalloc(((ArrayPtrT)h)->arena, sizeof(IteratorT));
 	if (iter == NULL)
 		return NULL;
 	iter->handle = (ArrayPtrT)h;
 	iter->index = index;
+	iter->arena = ((ArrayPtrT)h)->arena;
 	return iter;
 }
 
 static void InsertElementAtIndex(LSQ_HandleT handle, LSQ_IntegerIndexT index, LSQ_BaseTypeT element){
 	ArrayPtrT h = (ArrayPtrT)handle;
 	LSQ_BaseTypeT* PlaceOfElement = NULL;
+	LSQ_BaseTypeT* data = NULL;
+	int new_size;
+	LSQ_STAT_TIMER(start);
 	if(h == NULL) 
 		return;
+	/* В арене старый буфер не освобождается, поэтому он растёт вдвое, а не на один элемент */
 	if(h->physical_size == h->logical_size){
-		h->logical_size++;
-		h->data = (LSQ_BaseTypeT*)realloc(h->data, sizeof(LSQ_BaseTypeT) * h->logical_size);
+		new_size = (h->arena != LSQ_ArenaInvalid) ? h->logical_size * 2 : h->logical_size + 1;
+		data = (LSQ_BaseTypeT*)LSQ_ArenaRealloc(h->arena, h->data, sizeof(LSQ_BaseTypeT) * h->logical_size, sizeof(LSQ_BaseTypeT) * new_size);
+		if (data == NULL)
+			return;
+		h->data = data;
+		h->logical_size = new_size;
+		LSQ_STAT_ADD(reallocs, 1);
 	}	
 	PlaceOfElement = h->data + index;
 	memmove(PlaceOfElement + 1, PlaceOfElement, sizeof(LSQ_BaseTypeT) * (h->physical_size - index));	
+	LSQ_STAT_ADD(bytes_moved, sizeof(LSQ_BaseTypeT) * (h->physical_size - index));
 	*PlaceOfElement = element;
 	h->physical_size++;
+	LSQ_STAT_LATENCY(start);
 }
 
 static void DeleteElementAtIndex(LSQ_HandleT handle, LSQ_IntegerIndexT index){
 	ArrayPtrT h = (ArrayPtrT)handle;
 	LSQ_BaseTypeT* PlaceOfElement = NULL;
+	LSQ_STAT_TIMER(start);
 	if(h == NULL) 
 		return;
 	if (h->physical_size > 0){
 		PlaceOfElement = h->data + index;
-		memmove(PlaceOfElement , PlaceOfElement + 1, sizeof(LSQ_BaseTypeT) * (h->physical_size - index));	
+		memmove(PlaceOfElement , PlaceOfElement + 1, sizeof(LSQ_BaseTypeT) * (h->physical_size - index - 1));	
+		LSQ_STAT_ADD(bytes_moved, sizeof(LSQ_BaseTypeT) * (h->physical_size - index - 1));
 		h->physical_size--;
 	}
+	LSQ_STAT_LATENCY(start);
 }
 
-/* Функция, создающая пустой контейнер. Возвращает назначенный ему дескриптор */
-extern LSQ_HandleT LSQ_CreateSequence(void){
-	ArrayPtrT h = (ArrayPtrT)malloc(sizeof(ArrayT));
+/* Функция, создающая пустой контейнер в арене arena (LSQ_ArenaInvalid - в куче). Все данные контейнера и его   *
+ * итераторы размещаются в арене, и уничтожение контейнера не освобождает память по отдельности                  */
+extern LSQ_HandleT LSQ_CreateSequenceInArena(LSQ_ArenaT arena){
+	ArrayPtrT h = (ArrayPtrT)LSQ_ArenaMalloc(arena, sizeof(ArrayT));
 	if (h == LSQ_HandleInvalid)
 		return LSQ_HandleInvalid;
-	h->data = (LSQ_BaseTypeT*)malloc(sizeof(LSQ_BaseTypeT) * 10);
+	h->data = (LSQ_BaseTypeT*)LSQ_ArenaMalloc(arena, sizeof(LSQ_BaseTypeT) * CONTAINER_INITIAL_SIZE);
+	if (h->data == NULL){
+		LSQ_ArenaFree(arena, h);
+		return LSQ_HandleInvalid;
+	}
 	h->physical_size = 0;
 	h->logical_size = CONTAINER_INITIAL_SIZE; 
+	h->arena = arena;
 	return h;
 }
 
+/* Функция, создающая пустой контейнер. Возвращает назначенный ему дескриптор */
+extern LSQ_HandleT LSQ_CreateSequence(void){
+	return LSQ_CreateSequenceInArena(LSQ_ArenaInvalid);
+}
+
 /* Функция, уничтожающая контейнер с заданным дескриптором. Освобождает принадлежащую ему память */
 extern void LSQ_DestroySequence(LSQ_HandleT handle){
 	if (handle != LSQ_HandleInvalid){
-		free(((ArrayPtrT)handle)->data);
-		free(handle);
+		LSQ_ArenaFree(((ArrayPtrT)handle)->arena, ((ArrayPtrT)handle)->data);
+		LSQ_ArenaFree(((ArrayPtrT)handle)->arena, handle);
 	}
 }
 
@@ -120,7 +151,8 @@ extern LSQ_IteratorT LSQ_GetPastRearElement(LSQ_HandleT handle){
 
 /* Функция, уничтожающая итератор с заданным дескриптором и освобождающая принадлежащую ему память */
 extern void LSQ_DestroyIterator(LSQ_IteratorT iterator){
-	free(iterator);
+	if (iterator != NULL)
+		LSQ_ArenaFree(((IteratorPtrT)iterator)->arena, iterator);
 }
 
 /* Функция, перемещающая итератор на один элемент вперед */
@@ -190,3 +222,101 @@ extern void LSQ_DeleteGivenElement(LSQ_IteratorT iterator){
 		return;
 	DeleteElementAtIndex(iter->handle, iter->index);
 }
+
+/* Функция, возвращающая указатель на непрерывный участок памяти с элементами контейнера, начиная с индекса first. *
+ * В length записывается число элементов участка (не более count). Указатель действителен до следующего изменения  *
+ * контейнера.                                                                                                       */
+extern LSQ_BaseTypeT* LSQ_GetRangeSpan(LSQ_HandleT handle, LSQ_IntegerIndexT first, LSQ_IntegerIndexT count, LSQ_IntegerIndexT* length){
+	ArrayPtrT h = (ArrayPtrT)handle;
+	if (length != NULL)
+		*length = 0;
+	if (h == LSQ_HandleInvalid || first < 0 || count <= 0 || first >= h->physical_size)
+		return NULL;
+	if (count > h->physical_size - first)
+		count = h->physical_size - first;
+	if (length != NULL)
+		*length = count;
+	return h->data + first;
+}
+
+/* Функция, возвращающая указатель на все элементы контейнера. В length записывается их количество */
+extern LSQ_BaseTypeT* LSQ_GetSpan(LSQ_HandleT handle, LSQ_IntegerIndexT* length){
+	return LSQ_GetRangeSpan(handle, 0, LSQ_GetSize(handle), length);
+}
+
+typedef struct {
+	ArrayPtrT handle;
+	void (*action)(LSQ_BaseTypeT* element, void* arg);
+	LSQ_BaseTypeT (*map)(LSQ_BaseTypeT element, void* arg);
+	LSQ_BaseTypeT (*combine)(LSQ_BaseTypeT left, LSQ_BaseTypeT right);
+	LSQ_BaseTypeT identity;
+	LSQ_BaseTypeT* partials;
+	void* arg;
+}	ParallelJobT, *ParallelJobPtrT;
+
+static void RunParallelChunk(int chunk, void* arg){
+	ParallelJobPtrT job = (ParallelJobPtrT)arg;
+	LSQ_BaseTypeT* element = job->handle->data + (LSQ_IntegerIndexT)chunk * LSQ_PARALLEL_CHUNK;
+	LSQ_BaseTypeT* end = job->handle->data + job->handle->physical_size;
+	LSQ_BaseTypeT result = job->identity;
+	if (end - element > LSQ_PARALLEL_CHUNK)
+		end = element + LSQ_PARALLEL_CHUNK;
+	for (; element < end; element++)
+		if (job->action != NULL)
+			job->action(element, job->arg);
+		else if (job->map != NULL)
+			*element = job->map(*element, job->arg);
+		else
+			result = job->combine(result, *element);
+	if (job->partials != NULL)
+		job->partials[chunk] = result;
+}
+
+static int RunParallelJob(LSQ_HandleT handle, ParallelJobPtrT job){
+	if (handle == LSQ_HandleInvalid)
+		return 0;
+	job->handle = (ArrayPtrT)handle;
+	LSQ_ParallelRun(RunParallelChunk, job, (job->handle->physical_size + LSQ_PARALLEL_CHUNK - 1) / LSQ_PARALLEL_CHUNK);
+	return 1;
+}
+
+/* Функция, параллельно вызывающая action для каждого элемента контейнера */
+extern void LSQ_ParallelForEach(LSQ_HandleT handle, void (*action)(LSQ_BaseTypeT* element, void* arg), void* arg){
+	ParallelJobT job = { NULL, NULL, NULL, NULL, 0, NULL, NULL };
+	if (action == NULL)
+		return;
+	job.action = action;
+	job.arg = arg;
+	RunParallelJob(handle, &job);
+}
+
+/* Функция, параллельно заменяющая каждый элемент контейнера на map(элемент) */
+extern void LSQ_ParallelTransform(LSQ_HandleT handle, LSQ_BaseTypeT (*map)(LSQ_BaseTypeT element, void* arg), void* arg){
+	ParallelJobT job = { NULL, NULL, NULL, NULL, 0, NULL, NULL };
+	if (map == NULL)
+		return;
+	job.map = map;
+	job.arg = arg;
+	RunParallelJob(handle, &job);
+}
+
+/* Функция, сворачивающая элементы контейнера операцией combine. Части свёртки вычисляются параллельно и        *
+ * объединяются в порядке индексов, поэтому результат не зависит от числа потоков.                                 */
+extern LSQ_BaseTypeT LSQ_ParallelReduce(LSQ_HandleT handle, LSQ_BaseTypeT identity, LSQ_BaseTypeT (*combine)(LSQ_BaseTypeT left, LSQ_BaseTypeT right)){
+	ParallelJobT job = { NULL, NULL, NULL, NULL, 0, NULL, NULL };
+	LSQ_BaseTypeT result = identity;
+	int chunks, i;
+	if (handle == LSQ_HandleInvalid || combine == NULL)
+		return identity;
+	chunks = (((ArrayPtrT)handle)->physical_size + LSQ_PARALLEL_CHUNK - 1) / LSQ_PARALLEL_CHUNK;
+	job.combine = combine;
+	job.identity = identity;
+	job.partials = (LSQ_BaseTypeT*)malloc(sizeof(LSQ_BaseTypeT) * (chunks > 0 ? chunks : 1));
+	if (job.partials == NULL)
+		return identity;
+	RunParallelJob(handle, &job);
+	for (i = 0; i < chunks; i++)
+		result = combine(result, job.partials[i]);
+	free(job.partials);
+	return result;
+}
@@ -1,7 +1,52 @@
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+
 #include "linear_sequence_assoc.h"
+#include "lsq_stats.h"
+#include "lsq_epoch.h"
+#include "lsq_parallel.h"
+#include "lsq_reclaim.h"
+#include "lsq_arena.h"
+#include "lsq_generic.h"
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define LSQ_HAVE_MMAP
+#define LSQ_HAVE_PTHREADS
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sched.h>
+#endif
 
 #define LSQ_IteratorInvalid NULL
 
+#define SNAPSHOT_FILE_MAGIC 0x5453534C
+#define SNAPSHOT_FILE_VERSION 1
+
+#define JOURNAL_RECORD_INSERT 'I'
+#define JOURNAL_RECORD_DELETE 'D'
+#define JOURNAL_RECORD_PAYLOAD (1 + sizeof(LSQ_IntegerIndexT) + sizeof(LSQ_BaseTypeT))
+#define JOURNAL_RECORD_SIZE (JOURNAL_RECORD_PAYLOAD + sizeof(uint32_t))
+#define JOURNAL_BUFFER_SIZE (4096 * JOURNAL_RECORD_SIZE)
+
+#define OPTIMISTIC_READ_SPINS 64
+#define OPTIMISTIC_READ_MAX_DEPTH 128
+#define OPTIMISTIC_CHANGED_VERSIONS 512
+
+#define FILTER_BLOCK_WORDS 8
+#define FILTER_BLOCK_COUNTERS (FILTER_BLOCK_WORDS * 16)
+#define FILTER_COUNTER_MAX 15
+#define FILTER_MAX_HASHES 7
+#define FILTER_STAT_SLOTS 16
+
 // -
 
 typedef enum {
@@ -19,64 +64,169 @@ typedef struct ItemT {
 
 	int height;
 
+	unsigned long version;
+
 } TreeNodeT, *TreeNodePtrT;
 
+//        :    1,   k -  2k  2k+1.
+//      :    PROT_READ,  LSQ_DereferenceIterator
+//    NULL,      
+
+typedef struct {
+	int magic;
+	int version;
+	int size;
+	int record_size;
+} SnapshotHeaderT, *SnapshotHeaderPtrT;
+
+typedef struct {
+	LSQ_IntegerIndexT key;
+	LSQ_BaseTypeT value;
+} SnapshotRecordT, *SnapshotRecordPtrT;
+
+//  :    ,     window_ms       fsync.
+//      fsync     error    : committed  ,
+//  LSQ_SyncJournal  ,  LSQ_CheckpointJournal    
+
+#ifdef LSQ_HAVE_PTHREADS
+typedef struct {
+	int fd;
+	char* path;
+	unsigned char* active;
+	unsigned char* flushing;
+	size_t used;
+	unsigned long appended;
+	unsigned long committed;
+	int error;
+	int window_ms;
+	int stop;
+	pthread_mutex_t lock;
+	pthread_cond_t wakeup;
+	pthread_cond_t flushed;
+	pthread_t flusher;
+} JournalT, *JournalPtrT;
+#else
+typedef void* JournalPtrT;
+#endif
+
+//  :   .        
+//  version      changed,  EndWrite      . ,
+//       ( ,     ),   .
+//   version    ,       changed. 
+//   :          ,   - 
+//  ;    ,     ,   .
+//     lsq_epoch,      
+
+#ifdef LSQ_HAVE_PTHREADS
+typedef struct {
+	pthread_mutex_t writer;
+	unsigned long version;
+	unsigned long* changed[OPTIMISTIC_CHANGED_VERSIONS];
+	int changed_count;
+} TreeLockT, *TreeLockPtrT;
+#else
+typedef void* TreeLockPtrT;
+#endif
+
+//   :      4- ,     
+//     -.      ( FILTER_COUNTER_MAX  
+// ),          capacity.     
+//         lsq_epoch
+
+typedef struct {
+	uint64_t* blocks;
+	size_t block_count;
+	int hash_count;
+	int bits_per_key;
+	LSQ_IntegerIndexT capacity;
+} LookupFilterT, *LookupFilterPtrT;
+
+//         -:      ,
+//  LSQ_GetLookupFilterFalsePositiveRate  .       
+
+typedef struct {
+	unsigned long negatives;
+	unsigned long false_positives;
+	char padding[64 - 2 * sizeof(unsigned long)];
+} FilterStatSlotT, *FilterStatSlotPtrT;
+
 typedef struct {
 	LSQ_BaseTypeT size;
 	TreeNodePtrT root;
+	LookupFilterPtrT filter;
+	void* filter_stats;
+	LSQ_ArenaT arena;
+	TreeLockPtrT lock;
+	JournalPtrT journal;
+	SnapshotHeaderPtrT snapshot;
+	SnapshotRecordPtrT records;
+	size_t snapshot_length;
 } TreeT, *TreePtrT;
 
 typedef struct {
 	IteratorTypeT type;
 	TreePtrT tree;
 	TreeNodePtrT node;
+	LSQ_IntegerIndexT position;
+	LSQ_ArenaT arena;
 } IteratorT, *IteratorPtrT;
 
+//  :       (      ),
+//    ;        
+
+typedef struct {
+	TreeNodePtrT node;
+	int whole_subtree;
+} TreePieceT, *TreePiecePtrT;
+
+typedef struct {
+	TreePiecePtrT pieces;
+	void (*action)(LSQ_IntegerIndexT key, LSQ_BaseTypeT* value, void* arg);
+	LSQ_BaseTypeT (*map)(LSQ_IntegerIndexT key, LSQ_BaseTypeT value, void* arg);
+	LSQ_BaseTypeT (*combine)(LSQ_BaseTypeT left, LSQ_BaseTypeT right);
+	LSQ_BaseTypeT identity;
+	LSQ_BaseTypeT* partials;
+	void* arg;
+} TreeParallelJobT, *TreeParallelJobPtrT;
+
 static IteratorPtrT CreateIterator(LSQ_HandleT h, TreeNodePtrT node, IteratorTypeT type);
 
 static TreeNodePtrT GetNodeByKey(TreeNodePtrT node, LSQ_IntegerIndexT key);
 
-static TreeNodePtrT GetTreeMinimum(TreeNodePtrT node);
+static TreeNodePtrT CreateNode(TreePtrT tree, LSQ_IntegerIndexT key, LSQ_BaseTypeT value, TreeNodePtrT parent);
 
-static TreeNodePtrT GetTreeMaximum(TreeNodePtrT node);
+static void ReleaseNode(TreePtrT tree, TreeNodePtrT node);
 
-static TreeNodePtrT CreateNode(LSQ_IntegerIndexT key, LSQ_BaseTypeT value, TreeNodePtrT parent);
+static LSQ_IntegerIndexT GetSnapshotFirst(TreePtrT tree);
 
-static void ReplaceNode(TreePtrT tree, TreeNodePtrT node, TreeNodePtrT new_node);
+static LSQ_IntegerIndexT GetSnapshotLast(TreePtrT tree);
 
-static void FreeNode(TreeNodePtrT node);
+static LSQ_IntegerIndexT GetSnapshotNext(TreePtrT tree, LSQ_IntegerIndexT position);
 
-static int GetNodeHeight(TreeNodePtrT node);
+static LSQ_IntegerIndexT GetSnapshotPrevious(TreePtrT tree, LSQ_IntegerIndexT position);
 
-static int NodeBalanceFactor(TreeNodePtrT node);
+static LSQ_IntegerIndexT GetSnapshotPositionByKey(TreePtrT tree, LSQ_IntegerIndexT key);
 
-static void RefreshNodeHeight(TreeNodePtrT node);
+static TreeNodePtrT FindOrInsertNode(TreePtrT tree, LSQ_IntegerIndexT key, LSQ_BaseTypeT value, int* inserted);
 
-static void LeftRotate(TreeNodePtrT node, TreePtrT tree);
+static int InsertNode(TreePtrT tree, LSQ_IntegerIndexT key, LSQ_BaseTypeT value);
 
-static void RightRotate(TreeNodePtrT node, TreePtrT tree);
+static void UnlinkNode(TreePtrT tree, TreeNodePtrT node);
 
-static void Balance(TreePtrT tree, TreeNodePtrT node, int stop_criterion);
+static int RebuildFilter(TreePtrT tree, int bits_per_key);
 
-static int max(int a, int b){
-	return a > b ? a : b;
-}
+static int DeleteNodeByKey(TreePtrT tree, LSQ_IntegerIndexT key);
 
-static TreeNodePtrT GetTreeMinimum(TreeNodePtrT node){
-	while (node->left != NULL)
-		node = node->left;
-	return node;
-}
+static void AppendJournalRecord(TreePtrT tree, unsigned char type, LSQ_IntegerIndexT key, LSQ_BaseTypeT value);
 
+extern LSQ_BaseTypeT LSQ_GetIteratorValue(LSQ_IteratorT iterator);
 
-static TreeNodePtrT GetTreeMaximum(TreeNodePtrT node){
-	while (node->right != NULL) 
-		node = node->right;
-	return node;
-}
+#ifdef LSQ_HAVE_PTHREADS
+static int SyncJournal(JournalPtrT journal);
+#endif
 
-static TreeNodePtrT CreateNode(LSQ_IntegerIndexT key, LSQ_BaseTypeT value, TreeNodePtrT parent){
-	TreeNodePtrT node = (TreeNodePtrT)malloc(sizeof(TreeNodeT));
+static TreeNodePtrT CreateNode(TreePtrT tree, LSQ_IntegerIndexT key, LSQ_BaseTypeT value, TreeNodePtrT parent){
+	TreeNodePtrT node = (TreeNodePtrT)LSQ_ArenaMalloc(tree->arena, sizeof(TreeNodeT));
 	if (node == NULL)
 		return NULL;
 	node->key = key;
@@ -84,123 +234,978 @@ static TreeNodePtrT CreateNode(LSQ_IntegerIndexT key, LSQ_BaseTypeT value, TreeN
 	node->parent = parent;
 	node->left = NULL;
 	node->right = NULL;
+	node->height = 1;
+	node->version = 0;
+	LSQ_STAT_ADD(node_allocations, 1);
 	return node;
 }
 
-static void FreeNode(TreeNodePtrT node){
+static void ReleaseNode(TreePtrT tree, TreeNodePtrT node){
+#ifdef LSQ_HAVE_PTHREADS
+	if (tree->lock != NULL) {
+		LSQ_EpochRetire(node, free);
+		return;
+	}
+#endif
+	LSQ_ArenaFree(tree->arena, node);
+}
+
+static void BeginWrite(TreePtrT tree){
+#ifdef LSQ_HAVE_PTHREADS
+	if (tree->lock == NULL)
+		return;
+	LSQ_EpochEnter();
+	pthread_mutex_lock(&tree->lock->writer);
+#endif
+}
+
+static void MarkVersionChanging(TreePtrT tree, unsigned long* version){
+#ifdef LSQ_HAVE_PTHREADS
+	TreeLockPtrT lock = tree->lock;
+	if (lock == NULL || (lock->version & 1) || (*version & 1))
+		return;
+	if (lock->changed_count == OPTIMISTIC_CHANGED_VERSIONS - 1)
+		version = &lock->version;
+	__atomic_store_n(version, *version + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	lock->changed[lock->changed_count++] = version;
+#endif
+}
+
+static void MarkTreeChanging(TreePtrT tree){
+#ifdef LSQ_HAVE_PTHREADS
+	if (tree->lock != NULL)
+		MarkVersionChanging(tree, &tree->lock->version);
+#endif
+}
+
+static void MarkNodeChanging(TreePtrT tree, TreeNodePtrT node){
 	if (node == NULL)
+		MarkTreeChanging(tree);
+	else
+		MarkVersionChanging(tree, &node->version);
+}
+
+static void SetNodeLink(TreeNodePtrT* link, TreeNodePtrT node){
+	__atomic_store_n(link, node, __ATOMIC_RELEASE);
+}
+
+// ,       lsq_generic.h;       
+//   ,      
+
+#define TREE_HOOK_CHANGING(t, node) MarkNodeChanging((t), (node))
+#define TREE_HOOK_LINK(t, link, node) SetNodeLink((link), (node))
+#define TREE_HOOK_ROTATED(t) LSQ_STAT_ADD(rotations, 1)
+#define TREE_HOOK_STEP(t) LSQ_STAT_ADD(rebalance_steps, 1)
+
+LSQ_DEFINE_AVL_ALGORITHMS(Tree, TreeNodeT, TreeT, TREE_HOOK)
+
+//  window_ms == 0           , 
+// fsync    ,        fsync
+
+static void EndWrite(TreePtrT tree){
+#ifdef LSQ_HAVE_PTHREADS
+	int i;
+	if (tree->lock != NULL) {
+		for (i = 0; i < tree->lock->changed_count; i++)
+			__atomic_store_n(tree->lock->changed[i], *tree->lock->changed[i] + 1, __ATOMIC_RELEASE);
+		tree->lock->changed_count = 0;
+		pthread_mutex_unlock(&tree->lock->writer);
+		LSQ_EpochExit();
+	}
+	if (tree->journal != NULL && tree->journal->window_ms == 0)
+		SyncJournal(tree->journal);
+#endif
+}
+
+/* ,        ,      */
+static void BeginRead(TreePtrT tree){
+#ifdef LSQ_HAVE_PTHREADS
+	if (tree->lock != NULL)
+		pthread_mutex_lock(&tree->lock->writer);
+#endif
+}
+
+static void EndRead(TreePtrT tree){
+#ifdef LSQ_HAVE_PTHREADS
+	if (tree->lock != NULL)
+		pthread_mutex_unlock(&tree->lock->writer);
+#endif
+}
+
+#ifdef LSQ_HAVE_PTHREADS
+//    : direction == 0 -    *key, 1 -      *key,
+// -1 -     *key;  key == NULL -  (1)   (-1) .  0, 
+//        ,   *conflict  
+
+static int OptimisticSearch(TreePtrT tree, const LSQ_IntegerIndexT* key, int direction, TreeNodePtrT* found, LSQ_BaseTypeT* value, unsigned long** conflict){
+	unsigned long tree_version = __atomic_load_n(&tree->lock->version, __ATOMIC_ACQUIRE), version = 0, child_version = 0;
+	TreeNodePtrT node = NULL, child = NULL, result = NULL;
+	LSQ_BaseTypeT result_value = 0;
+	int depth, right;
+	*conflict = &tree->lock->version;
+	if (tree_version & 1)
+		return 0;
+	node = __atomic_load_n(&tree->root, __ATOMIC_ACQUIRE);
+	if (node != NULL)
+		version = __atomic_load_n(&node->version, __ATOMIC_ACQUIRE);
+	for (depth = 0; node != NULL; depth++) {
+		*conflict = &node->version;
+		if ((version & 1) || depth == OPTIMISTIC_READ_MAX_DEPTH)
+			return 0;
+		child = NULL;
+		if (key != NULL && direction == 0 && node->key == *key) {
+			result = node;
+			result_value = __atomic_load_n(&node->value, __ATOMIC_RELAXED);
+		}
+		else {
+			right = key == NULL ? direction < 0 : (direction > 0 ? node->key <= *key : node->key < *key);
+			if (direction != 0 && right == (direction < 0)) {
+				result = node;
+				result_value = __atomic_load_n(&node->value, __ATOMIC_RELAXED);
+			}
+			child = __atomic_load_n(right ? &node->right : &node->left, __ATOMIC_ACQUIRE);
+			if (child != NULL)
+				child_version = __atomic_load_n(&child->version, __ATOMIC_ACQUIRE);
+		}
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (__atomic_load_n(&node->version, __ATOMIC_RELAXED) != version)
+			return 0;
+		node = child;
+		version = child_version;
+	}
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	*conflict = &tree->lock->version;
+	if (__atomic_load_n(&tree->lock->version, __ATOMIC_RELAXED) != tree_version)
+		return 0;
+	LSQ_STAT_ADD(descent_depth, depth);
+	*found = result;
+	if (result != NULL && value != NULL)
+		*value = result_value;
+	return 1;
+}
+
+//  OptimisticSearch,      .    , 
+//     
+
+static TreeNodePtrT FindNodeConcurrently(TreePtrT tree, const LSQ_IntegerIndexT* key, int direction, LSQ_BaseTypeT* value){
+	TreeNodePtrT node = NULL;
+	unsigned long* conflict = NULL;
+	int spins;
+	LSQ_EpochEnter();
+	while (!OptimisticSearch(tree, key, direction, &node, value, &conflict))
+		for (spins = 0; __atomic_load_n(conflict, __ATOMIC_ACQUIRE) & 1; spins++)
+			if (spins >= OPTIMISTIC_READ_SPINS)
+				sched_yield();
+	LSQ_EpochExit();
+	return node;
+}
+#endif
+
+static uint64_t HashKey(LSQ_IntegerIndexT key){
+	uint64_t h = (uint64_t)key;
+	h ^= h >> 33;
+	h *= 0xFF51AFD7ED558CCDULL;
+	h ^= h >> 33;
+	h *= 0xC4CEB9FE1A85EC53ULL;
+	h ^= h >> 33;
+	return h;
+}
+
+static uint64_t* GetFilterBlock(LookupFilterPtrT filter, uint64_t hash){
+	return filter->blocks + FILTER_BLOCK_WORDS * (size_t)(((hash >> 32) * (uint64_t)filter->block_count) >> 32);
+}
+
+//   delta   key.    ,     
+
+static void UpdateFilterKey(LookupFilterPtrT filter, LSQ_IntegerIndexT key, int delta){
+	uint64_t hash = HashKey(key), bits = hash * 0x9E3779B97F4A7C15ULL, word;
+	uint64_t* block = GetFilterBlock(filter, hash);
+	int i, counter, shift;
+	for (i = 0; i < filter->hash_count; i++, bits >>= 7) {
+		counter = (int)(bits % FILTER_BLOCK_COUNTERS);
+		shift = 4 * (counter & 15);
+		word = __atomic_load_n(&block[counter >> 4], __ATOMIC_RELAXED);
+		if (((word >> shift) & 15) == FILTER_COUNTER_MAX || (delta < 0 && ((word >> shift) & 15) == 0))
+			continue;
+		__atomic_store_n(&block[counter >> 4], delta > 0 ? word + ((uint64_t)1 << shift) : word - ((uint64_t)1 << shift), __ATOMIC_RELAXED);
+	}
+}
+
+static FilterStatSlotPtrT GetFilterStatSlot(TreePtrT tree){
+	static LSQ_THREAD_LOCAL int slot = -1;
+	static int next_slot = 0;
+	if (slot < 0)
+		slot = __atomic_fetch_add(&next_slot, 1, __ATOMIC_RELAXED) % FILTER_STAT_SLOTS;
+	return (FilterStatSlotPtrT)(((uintptr_t)tree->filter_stats + 63) & ~(uintptr_t)63) + slot;
+}
+
+//  1,   key    
+
+static int FilterRejects(TreePtrT tree, LSQ_IntegerIndexT key){
+	LookupFilterPtrT filter = __atomic_load_n(&tree->filter, __ATOMIC_ACQUIRE);
+	uint64_t hash, bits;
+	uint64_t* block = NULL;
+	int i, counter;
+	if (filter == NULL)
+		return 0;
+	hash = HashKey(key);
+	bits = hash * 0x9E3779B97F4A7C15ULL;
+	block = GetFilterBlock(filter, hash);
+	for (i = 0; i < filter->hash_count; i++, bits >>= 7) {
+		counter = (int)(bits % FILTER_BLOCK_COUNTERS);
+		if (((__atomic_load_n(&block[counter >> 4], __ATOMIC_RELAXED) >> (4 * (counter & 15))) & 15) == 0) {
+			__atomic_fetch_add(&GetFilterStatSlot(tree)->negatives, 1, __ATOMIC_RELAXED);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static void CountFilterFalsePositive(TreePtrT tree){
+	if (__atomic_load_n(&tree->filter, __ATOMIC_ACQUIRE) != NULL)
+		__atomic_fetch_add(&GetFilterStatSlot(tree)->false_positives, 1, __ATOMIC_RELAXED);
+}
+
+static void ReleaseFilter(TreePtrT tree, LookupFilterPtrT filter){
+#ifdef LSQ_HAVE_PTHREADS
+	if (tree->lock != NULL) {
+		LSQ_EpochRetire(filter, free);
 		return;
-	FreeNode(node->left);
-	FreeNode(node->right);
-	free(node);
+	}
+#endif
+	free(filter);
+}
+
+//     2 * size + 64      ,   
+//  ,    .      
+
+static int RebuildFilter(TreePtrT tree, int bits_per_key){
+	LookupFilterPtrT filter = NULL, old = tree->filter;
+	TreeNodePtrT node = NULL;
+	LSQ_IntegerIndexT capacity = 2 * tree->size + 64, i;
+	size_t block_count = ((size_t)capacity * bits_per_key + FILTER_BLOCK_COUNTERS - 1) / FILTER_BLOCK_COUNTERS;
+	char* memory = (char*)malloc(sizeof(LookupFilterT) + 64 + block_count * FILTER_BLOCK_WORDS * sizeof(uint64_t));
+	if (memory == NULL)
+		return 0;
+	filter = (LookupFilterPtrT)memory;
+	filter->blocks = (uint64_t*)(memory + ((sizeof(LookupFilterT) + (uintptr_t)memory + 63) & ~(uintptr_t)63) - (uintptr_t)memory);
+	memset(filter->blocks, 0, block_count * FILTER_BLOCK_WORDS * sizeof(uint64_t));
+	filter->block_count = block_count;
+	filter->bits_per_key = bits_per_key;
+	filter->hash_count = bits_per_key * 69 / 100;
+	if (filter->hash_count < 1)
+		filter->hash_count = 1;
+	if (filter->hash_count > FILTER_MAX_HASHES)
+		filter->hash_count = FILTER_MAX_HASHES;
+	filter->capacity = capacity;
+	if (tree->snapshot != NULL)
+		for (i = 0; i < tree->size; i++)
+			UpdateFilterKey(filter, tree->records[i].key, 1);
+	else
+		for (node = tree->root != NULL ? Tree_Minimum(tree->root) : NULL; node != NULL; node = Tree_Next(node))
+			UpdateFilterKey(filter, node->key, 1);
+	__atomic_store_n(&tree->filter, filter, __ATOMIC_RELEASE);
+	if (old != NULL)
+		ReleaseFilter(tree, old);
+	return 1;
+}
+
+static void NoteInsertedKey(TreePtrT tree, LSQ_IntegerIndexT key){
+	if (tree->filter == NULL)
+		return;
+	if (tree->size > tree->filter->capacity)
+		RebuildFilter(tree, tree->filter->bits_per_key);
+	else
+		UpdateFilterKey(tree->filter, key, 1);
+}
+
+static void NoteDeletedKey(TreePtrT tree, LSQ_IntegerIndexT key){
+	if (tree->filter != NULL)
+		UpdateFilterKey(tree->filter, key, -1);
 }
 
 static TreeNodePtrT GetNodeByKey(TreeNodePtrT node, LSQ_IntegerIndexT key){
-	while (node != NULL && node->key != key) 
+	int depth = 0;
+	while (node != NULL && node->key != key) {
 		if (node->key < key)
 			node = node->right;
 		else
 			node = node->left;
+		depth++;
+	}
+	LSQ_STAT_ADD(descent_depth, depth);
 	return  node;
 }
 
+//          LSQ_DestroyIterator,   
+//   ,    ;       
+
 static IteratorPtrT CreateIterator(LSQ_HandleT h, TreeNodePtrT node, IteratorTypeT type){
-	IteratorPtrT iter = (IteratorPtrT) malloc(sizeof(IteratorT));
+	LSQ_ArenaT arena = h != LSQ_HandleInvalid ? ((TreePtrT)h)->arena : LSQ_ArenaInvalid;
+	IteratorPtrT iter = (IteratorPtrT) LSQ_ArenaMalloc(arena, sizeof(IteratorT));
 	if (iter == LSQ_IteratorInvalid)
 		return LSQ_IteratorInvalid;
+#ifdef LSQ_HAVE_PTHREADS
+	if (h != LSQ_HandleInvalid && ((TreePtrT)h)->lock != NULL)
+		LSQ_EpochEnter();
+#endif
+	iter->arena = arena;
 	iter->node = node;
 	iter->tree = (TreePtrT) h;
 	iter->type = type;
+	iter->position = 0;
 	return iter;
 }
 
-static void ReplaceNode(TreePtrT tree, TreeNodePtrT node, TreeNodePtrT new_node){
-    if (new_node != NULL)
-        new_node->parent = node->parent;
-    if (node->parent == NULL)
-        tree->root = new_node;
-    else 
-        if (node->parent->left == node)
-            node->parent->left = new_node;
-        else
-            node->parent->right = new_node;
-}
-
-static int GetNodeHeight(TreeNodePtrT node) {
-    return node == NULL ? 0 : node->height;
-}
-
-static int NodeBalanceFactor(TreeNodePtrT node) {
-    return GetNodeHeight(node->left) - GetNodeHeight(node->right);
-}
-
-static void RefreshNodeHeight(TreeNodePtrT node) {
-    node->height = 1 + max(GetNodeHeight(node->left), GetNodeHeight(node->right));
-}
-
-
-static void LeftRotate(TreeNodePtrT node, TreePtrT tree){
-    TreeNodePtrT new_root = node->right;
-    ReplaceNode(tree, node, new_root);
-    node->right = new_root->left;
-    if (node->right != NULL)
-        node->right->parent = node;
-    node->parent = new_root;
-    new_root->left = node;
-    RefreshNodeHeight(node);
-    RefreshNodeHeight(new_root);	
-}
-
-static void RightRotate(TreeNodePtrT node, TreePtrT tree){
-    TreeNodePtrT new_root = node->left;
-    ReplaceNode(tree, node, new_root);
-    node->left = new_root->right;
-    if (node->left != NULL)
-        node->left->parent = node;
-    node->parent = new_root;
-    new_root->right = node;
-    RefreshNodeHeight(node);
-    RefreshNodeHeight(new_root);	
-}
-
-static void Balance(TreePtrT tree, TreeNodePtrT node, int stop_criterion) {
-    TreeNodePtrT parent;
-    int node_balance;
-    while (node != NULL) {
-        RefreshNodeHeight(node);
-        node_balance = NodeBalanceFactor(node);
-        parent = node->parent;
-        if (abs(node_balance) == stop_criterion)
-            return;
-        else 
-			if (node_balance == -2) {
-				if (NodeBalanceFactor(node->right) > 0)
-					RightRotate(node->right, tree);
-            LeftRotate(node, tree);
+static LSQ_IntegerIndexT GetSnapshotFirst(TreePtrT tree){
+	LSQ_IntegerIndexT position = tree->size > 0 ? 1 : 0;
+	while (position > 0 && 2 * position <= tree->size)
+		position = 2 * position;
+	return position;
+}
+
+static LSQ_IntegerIndexT GetSnapshotLast(TreePtrT tree){
+	LSQ_IntegerIndexT position = tree->size > 0 ? 1 : 0;
+	while (position > 0 && 2 * position + 1 <= tree->size)
+		position = 2 * position + 1;
+	return position;
+}
+
+static LSQ_IntegerIndexT GetSnapshotNext(TreePtrT tree, LSQ_IntegerIndexT position){
+	if (2 * position + 1 <= tree->size) {
+		position = 2 * position + 1;
+		while (2 * position <= tree->size)
+			position = 2 * position;
+		return position;
+	}
+	while (position & 1)
+		position >>= 1;
+	return position >> 1;
+}
+
+static LSQ_IntegerIndexT GetSnapshotPrevious(TreePtrT tree, LSQ_IntegerIndexT position){
+	if (2 * position <= tree->size) {
+		position = 2 * position;
+		while (2 * position + 1 <= tree->size)
+			position = 2 * position + 1;
+		return position;
+	}
+	while (position > 0 && !(position & 1))
+		position >>= 1;
+	return position >> 1;
+}
+
+static LSQ_IntegerIndexT GetSnapshotPositionByKey(TreePtrT tree, LSQ_IntegerIndexT key){
+	LSQ_IntegerIndexT position = 1;
+	while (position <= tree->size && tree->records[position - 1].key != key)
+		position = 2 * position + (tree->records[position - 1].key < key);
+	return position <= tree->size ? position : 0;
+}
+
+#ifdef LSQ_HAVE_MMAP
+//    path   : fsync ,    
+
+static int SyncDirectoryOf(const char* path){
+	const char* slash = strrchr(path, '/');
+	char* directory = (char*)malloc(strlen(path) + 2);
+	int fd, success;
+	if (directory == NULL)
+		return 0;
+	if (slash == NULL)
+		strcpy(directory, ".");
+	else {
+		memcpy(directory, path, slash == path ? 1 : (size_t)(slash - path));
+		directory[slash == path ? 1 : slash - path] = '\0';
+	}
+	fd = open(directory, O_RDONLY);
+	free(directory);
+	if (fd < 0)
+		return 0;
+	success = fsync(fd) == 0;
+	close(fd);
+	return success;
+}
+#endif
+
+static void FillSnapshot(SnapshotRecordPtrT records, LSQ_IntegerIndexT size, LSQ_IntegerIndexT position, LSQ_IteratorT iter){
+	if (position > size)
+		return;
+	FillSnapshot(records, size, 2 * position, iter);
+	records[position - 1].key = LSQ_GetIteratorKey(iter);
+	records[position - 1].value = LSQ_GetIteratorValue(iter);
+	LSQ_AdvanceOneElement(iter);
+	FillSnapshot(records, size, 2 * position + 1, iter);
+}
+
+#ifdef LSQ_HAVE_PTHREADS
+static int WriteAll(int fd, const unsigned char* buffer, size_t length){
+	ssize_t written;
+	while (length > 0) {
+		written = write(fd, buffer, length);
+		if (written < 0 && errno == EINTR)
+			continue;
+		if (written <= 0)
+			return 0;
+		buffer += written;
+		length -= written;
+	}
+	return 1;
+}
+
+static void* JournalFlusher(void* arg){
+	JournalPtrT journal = (JournalPtrT)arg;
+	unsigned char* buffer = NULL;
+	unsigned long target;
+	struct timeval now;
+	struct timespec deadline;
+	size_t length;
+	int fd, error;
+	pthread_mutex_lock(&journal->lock);
+	while (!journal->stop || journal->used > 0) {
+		//      ;         
+		while (journal->used == 0 && !journal->stop)
+			pthread_cond_wait(&journal->wakeup, &journal->lock);
+		if (journal->used > 0 && journal->window_ms > 0 && !journal->stop) {
+			gettimeofday(&now, NULL);
+			deadline.tv_sec = now.tv_sec + journal->window_ms / 1000;
+			deadline.tv_nsec = now.tv_usec * 1000L + (journal->window_ms % 1000) * 1000000L;
+			if (deadline.tv_nsec >= 1000000000L) {
+				deadline.tv_sec++;
+				deadline.tv_nsec -= 1000000000L;
 			}
-			else 
-				if (node_balance == 2) {
-					if (NodeBalanceFactor(node->left) < 0)
-						LeftRotate(node->left, tree);
-					RightRotate(node, tree);
-				}
-        node = parent;
-    }
+			pthread_cond_timedwait(&journal->wakeup, &journal->lock, &deadline);
+		}
+		if (journal->used == 0)
+			continue;
+		buffer = journal->active;
+		journal->active = journal->flushing;
+		journal->flushing = buffer;
+		length = journal->used;
+		target = journal->appended;
+		journal->used = 0;
+		fd = journal->fd;
+		if (journal->error != 0) {
+			pthread_cond_broadcast(&journal->flushed);
+			continue;
+		}
+		pthread_mutex_unlock(&journal->lock);
+		error = errno = 0;
+		if (!WriteAll(fd, buffer, length) || fsync(fd) != 0)
+			error = errno != 0 ? errno : EIO;
+		pthread_mutex_lock(&journal->lock);
+		if (error != 0)
+			journal->error = error;
+		else
+			journal->committed = target;
+		pthread_cond_broadcast(&journal->flushed);
+	}
+	pthread_mutex_unlock(&journal->lock);
+	return NULL;
 }
 
-extern LSQ_HandleT LSQ_CreateSequence(void){
-	TreePtrT t = (TreePtrT) malloc(sizeof(TreeT));
+static int SyncJournal(JournalPtrT journal){
+	unsigned long target;
+	int error;
+	pthread_mutex_lock(&journal->lock);
+	target = journal->appended;
+	pthread_cond_signal(&journal->wakeup);
+	while (journal->committed < target && journal->error == 0)
+		pthread_cond_wait(&journal->flushed, &journal->lock);
+	error = journal->error;
+	pthread_mutex_unlock(&journal->lock);
+	return error;
+}
+
+static void CloseJournal(JournalPtrT journal){
+	SyncJournal(journal);
+	pthread_mutex_lock(&journal->lock);
+	journal->stop = 1;
+	pthread_cond_signal(&journal->wakeup);
+	pthread_mutex_unlock(&journal->lock);
+	pthread_join(journal->flusher, NULL);
+	pthread_mutex_destroy(&journal->lock);
+	pthread_cond_destroy(&journal->wakeup);
+	pthread_cond_destroy(&journal->flushed);
+	close(journal->fd);
+	free(journal->active);
+	free(journal->flushing);
+	free(journal->path);
+	free(journal);
+}
+
+//  : , ,     FNV-1a   
+
+static uint32_t JournalChecksum(const unsigned char* record){
+	uint32_t hash = 2166136261u;
+	size_t i;
+	for (i = 0; i < JOURNAL_RECORD_PAYLOAD; i++)
+		hash = (hash ^ record[i]) * 16777619u;
+	return hash;
+}
+
+static void EncodeJournalRecord(unsigned char* record, unsigned char type, LSQ_IntegerIndexT key, LSQ_BaseTypeT value){
+	uint32_t checksum;
+	record[0] = type;
+	memcpy(record + 1, &key, sizeof(key));
+	memcpy(record + 1 + sizeof(key), &value, sizeof(value));
+	checksum = JournalChecksum(record);
+	memcpy(record + JOURNAL_RECORD_PAYLOAD, &checksum, sizeof(checksum));
+}
+
+static int DecodeJournalRecord(const unsigned char* record, unsigned char* type, LSQ_IntegerIndexT* key, LSQ_BaseTypeT* value){
+	uint32_t checksum;
+	memcpy(&checksum, record + JOURNAL_RECORD_PAYLOAD, sizeof(checksum));
+	if (checksum != JournalChecksum(record) || (record[0] != JOURNAL_RECORD_INSERT && record[0] != JOURNAL_RECORD_DELETE))
+		return 0;
+	*type = record[0];
+	memcpy(key, record + 1, sizeof(*key));
+	memcpy(value, record + 1 + sizeof(*key), sizeof(*value));
+	return 1;
+}
+
+//       (     
+// );      .  0,       :
+//       ,        
+
+static int ReplayJournal(TreePtrT tree, int fd){
+	unsigned char* buffer = (unsigned char*)malloc(JOURNAL_BUFFER_SIZE);
+	size_t used = 0, offset;
+	off_t valid = 0;
+	ssize_t count;
+	unsigned char type;
+	LSQ_IntegerIndexT key;
+	LSQ_BaseTypeT value;
+	int damaged = 0;
+	if (buffer == NULL)
+		return 0;
+	while (!damaged && (count = read(fd, buffer + used, JOURNAL_BUFFER_SIZE - used)) > 0) {
+		used += count;
+		for (offset = 0; offset + JOURNAL_RECORD_SIZE <= used; offset += JOURNAL_RECORD_SIZE) {
+			if (!DecodeJournalRecord(buffer + offset, &type, &key, &value)) {
+				damaged = 1;
+				break;
+			}
+			if (type == JOURNAL_RECORD_INSERT)
+				InsertNode(tree, key, value);
+			else
+				DeleteNodeByKey(tree, key);
+		}
+		valid += offset;
+		memmove(buffer, buffer + offset, used - offset);
+		used -= offset;
+	}
+	free(buffer);
+	if (count < 0)
+		return 0;
+	return !(damaged || used > 0) || ftruncate(fd, valid) == 0;
+}
+
+static JournalPtrT OpenJournal(const char* path, int fd, int window_ms){
+	JournalPtrT journal = (JournalPtrT)malloc(sizeof(JournalT));
+	if (journal == NULL)
+		return NULL;
+	journal->fd = fd;
+	journal->path = (char*)malloc(strlen(path) + 1);
+	journal->active = (unsigned char*)malloc(JOURNAL_BUFFER_SIZE);
+	journal->flushing = (unsigned char*)malloc(JOURNAL_BUFFER_SIZE);
+	journal->used = 0;
+	journal->appended = 0;
+	journal->committed = 0;
+	journal->error = 0;
+	journal->window_ms = window_ms;
+	journal->stop = 0;
+	pthread_mutex_init(&journal->lock, NULL);
+	pthread_cond_init(&journal->wakeup, NULL);
+	pthread_cond_init(&journal->flushed, NULL);
+	if (journal->path == NULL || journal->active == NULL || journal->flushing == NULL ||
+		pthread_create(&journal->flusher, NULL, JournalFlusher, journal) != 0) {
+		free(journal->path);
+		free(journal->active);
+		free(journal->flushing);
+		free(journal);
+		return NULL;
+	}
+	strcpy(journal->path, path);
+	return journal;
+}
+#endif
+
+static void AppendJournalRecord(TreePtrT tree, unsigned char type, LSQ_IntegerIndexT key, LSQ_BaseTypeT value){
+#ifdef LSQ_HAVE_PTHREADS
+	JournalPtrT journal = tree->journal;
+	if (journal == NULL)
+		return;
+	pthread_mutex_lock(&journal->lock);
+	while (journal->used + JOURNAL_RECORD_SIZE > JOURNAL_BUFFER_SIZE) {
+		pthread_cond_signal(&journal->wakeup);
+		pthread_cond_wait(&journal->flushed, &journal->lock);
+	}
+	EncodeJournalRecord(journal->active + journal->used, type, key, value);
+	journal->used += JOURNAL_RECORD_SIZE;
+	journal->appended++;
+	if (journal->window_ms == 0 || journal->used == JOURNAL_RECORD_SIZE)
+		pthread_cond_signal(&journal->wakeup);
+	pthread_mutex_unlock(&journal->lock);
+#endif
+}
+
+//   : ,        arena     ,
+//       O(1).  ,      
+
+extern LSQ_HandleT LSQ_CreateSequenceInArena(LSQ_ArenaT arena){
+	TreePtrT t = (TreePtrT) LSQ_ArenaMalloc(arena, sizeof(TreeT));
 	if (t == LSQ_HandleInvalid)
 		return LSQ_HandleInvalid;
 	t->root = NULL;
+	t->filter = NULL;
+	t->filter_stats = NULL;
+	t->arena = arena;
 	t->size = 0;
+	t->lock = NULL;
+	t->journal = NULL;
+	t->snapshot = NULL;
+	t->records = NULL;
+	t->snapshot_length = 0;
 	return t;
 }
 
+extern LSQ_HandleT LSQ_CreateSequence(void){
+	return LSQ_CreateSequenceInArena(LSQ_ArenaInvalid);
+}
+
+extern int LSQ_SaveSnapshot(LSQ_HandleT handle, const char* path){
+	TreePtrT tree = (TreePtrT)handle;
+	SnapshotHeaderT header;
+	SnapshotRecordPtrT records = NULL;
+	LSQ_IteratorT iter = NULL;
+	FILE* file = NULL;
+	char* temp_path = NULL;
+	int written;
+	if (tree == LSQ_HandleInvalid)
+		return 0;
+	BeginRead(tree);
+	header.size = tree->size;
+	records = (SnapshotRecordPtrT)malloc(sizeof(SnapshotRecordT) * (header.size > 0 ? header.size : 1));
+	temp_path = (char*)malloc(strlen(path) + 5);
+	iter = LSQ_GetFrontElement(handle);
+	if (records == NULL || temp_path == NULL || iter == LSQ_IteratorInvalid){
+		LSQ_DestroyIterator(iter);
+		EndRead(tree);
+		free(records);
+		free(temp_path);
+		return 0;
+	}
+	FillSnapshot(records, header.size, 1, iter);
+	LSQ_DestroyIterator(iter);
+	EndRead(tree);
+	header.magic = SNAPSHOT_FILE_MAGIC;
+	header.version = SNAPSHOT_FILE_VERSION;
+	header.record_size = sizeof(SnapshotRecordT);
+	//         : ,   
+	//  ,    ,         
+	strcpy(temp_path, path);
+	strcat(temp_path, ".tmp");
+	file = fopen(temp_path, "wb");
+	if (file == NULL){
+		free(records);
+		free(temp_path);
+		return 0;
+	}
+	written = fwrite(&header, sizeof(header), 1, file) == 1 &&
+		fwrite(records, sizeof(SnapshotRecordT), header.size, file) == (size_t)header.size && fflush(file) == 0;
+#ifdef LSQ_HAVE_MMAP
+	written = written && fsync(fileno(file)) == 0;
+#endif
+	free(records);
+	written = fclose(file) == 0 && written && rename(temp_path, path) == 0;
+#ifdef LSQ_HAVE_MMAP
+	written = written && SyncDirectoryOf(path);
+#endif
+	if (!written)
+		remove(temp_path);
+	free(temp_path);
+	return written;
+}
+
+extern LSQ_HandleT LSQ_OpenSnapshot(const char* path){
+#ifdef LSQ_HAVE_MMAP
+	TreePtrT tree = NULL;
+	SnapshotHeaderPtrT header = NULL;
+	struct stat st;
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return LSQ_HandleInvalid;
+	if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(SnapshotHeaderT)){
+		close(fd);
+		return LSQ_HandleInvalid;
+	}
+	header = (SnapshotHeaderPtrT)mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if ((void*)header == MAP_FAILED)
+		return LSQ_HandleInvalid;
+	tree = (TreePtrT)LSQ_CreateSequence();
+	if (tree == LSQ_HandleInvalid || header->magic != SNAPSHOT_FILE_MAGIC || header->version != SNAPSHOT_FILE_VERSION ||
+		header->record_size != sizeof(SnapshotRecordT) || header->size < 0 ||
+		sizeof(SnapshotHeaderT) + sizeof(SnapshotRecordT) * header->size != (size_t)st.st_size){
+		free(tree);
+		munmap(header, st.st_size);
+		return LSQ_HandleInvalid;
+	}
+	tree->snapshot = header;
+	tree->records = (SnapshotRecordPtrT)(header + 1);
+	tree->snapshot_length = st.st_size;
+	tree->size = header->size;
+	return tree;
+#else
+	return LSQ_HandleInvalid;
+#endif
+}
+
+static void ReleaseTree(TreePtrT tree){
+	free(tree->filter);
+	free(tree->filter_stats);
+#ifdef LSQ_HAVE_MMAP
+	if (tree->snapshot != NULL)
+		munmap(tree->snapshot, tree->snapshot_length);
+#endif
+#ifdef LSQ_HAVE_PTHREADS
+	if (tree->journal != NULL)
+		CloseJournal(tree->journal);
+	if (tree->lock != NULL) {
+		pthread_mutex_destroy(&tree->lock->writer);
+		free(tree->lock);
+	}
+#endif
+	LSQ_ArenaFree(tree->arena, tree);
+}
 
 extern void LSQ_DestroySequence(LSQ_HandleT handle){
-	FreeNode(((TreePtrT)handle)->root);
-	free(handle);
+	TreePtrT tree = (TreePtrT)handle;
+	if (tree == LSQ_HandleInvalid)
+		return;
+	if (tree->arena == LSQ_ArenaInvalid)
+		Tree_FreeNodes(&tree->root, -1);
+	ReleaseTree(tree);
+}
+
+extern int LSQ_DestroySequenceStep(LSQ_HandleT handle, LSQ_IntegerIndexT budget){
+	TreePtrT tree = (TreePtrT)handle;
+	if (tree == LSQ_HandleInvalid)
+		return 1;
+	if (tree->arena == LSQ_ArenaInvalid && !Tree_FreeNodes(&tree->root, budget > 0 ? budget : 1))
+		return 0;
+	ReleaseTree(tree);
+	return 1;
+}
+
+static int DestroyStep(void* handle, int budget){
+	return LSQ_DestroySequenceStep(handle, budget);
+}
+
+extern void LSQ_DestroySequenceInBackground(LSQ_HandleT handle){
+	LSQ_ReclaimInBackground(handle, DestroyStep);
+}
+
+extern LSQ_HandleT LSQ_CreateConcurrentSequence(void){
+#ifdef LSQ_HAVE_PTHREADS
+	TreePtrT tree = (TreePtrT)LSQ_CreateSequence();
+	if (tree == LSQ_HandleInvalid)
+		return LSQ_HandleInvalid;
+	tree->lock = (TreeLockPtrT)malloc(sizeof(TreeLockT));
+	if (tree->lock == NULL) {
+		free(tree);
+		return LSQ_HandleInvalid;
+	}
+	pthread_mutex_init(&tree->lock->writer, NULL);
+	tree->lock->version = 0;
+	tree->lock->changed_count = 0;
+	return tree;
+#else
+	return LSQ_CreateSequence();
+#endif
+}
+
+extern int LSQ_LookupElement(LSQ_HandleT handle, LSQ_IntegerIndexT key, LSQ_BaseTypeT* value){
+	TreePtrT tree = (TreePtrT)handle;
+	TreeNodePtrT node = NULL;
+	LSQ_IntegerIndexT position;
+	if (tree == LSQ_HandleInvalid)
+		return 0;
+	if (tree->snapshot != NULL) {
+		if (FilterRejects(tree, key))
+			return 0;
+		position = GetSnapshotPositionByKey(tree, key);
+		if (position != 0 && value != NULL)
+			*value = tree->records[position - 1].value;
+		if (position == 0)
+			CountFilterFalsePositive(tree);
+		return position != 0;
+	}
+#ifdef LSQ_HAVE_PTHREADS
+	if (tree->lock != NULL) {
+		LSQ_EpochEnter();
+		if (!FilterRejects(tree, key) && (node = FindNodeConcurrently(tree, &key, 0, value)) == NULL)
+			CountFilterFalsePositive(tree);
+		LSQ_EpochExit();
+		return node != NULL;
+	}
+#endif
+	if (FilterRejects(tree, key))
+		return 0;
+	node = GetNodeByKey(tree->root, key);
+	if (node != NULL && value != NULL)
+		*value = node->value;
+	if (node == NULL)
+		CountFilterFalsePositive(tree);
+	return node != NULL;
+}
+
+//      bits_per_key 4-    ( 1%    10);
+// bits_per_key <= 0  .  1  .      
+//  :   ,    lsq_epoch,    
+//   (,    ,       )
+
+extern int LSQ_EnableLookupFilter(LSQ_HandleT handle, int bits_per_key){
+	TreePtrT tree = (TreePtrT)handle;
+	FilterStatSlotPtrT slots = NULL;
+	int result = 1, i;
+	if (tree == LSQ_HandleInvalid)
+		return 0;
+	BeginWrite(tree);
+	if (bits_per_key > 0 && tree->filter_stats == NULL)
+		tree->filter_stats = calloc(FILTER_STAT_SLOTS + 1, sizeof(FilterStatSlotT));
+	if (bits_per_key > 0 && tree->filter == NULL && tree->filter_stats != NULL) {
+		slots = (FilterStatSlotPtrT)(((uintptr_t)tree->filter_stats + 63) & ~(uintptr_t)63);
+		for (i = 0; i < FILTER_STAT_SLOTS; i++) {
+			__atomic_store_n(&slots[i].negatives, 0, __ATOMIC_RELAXED);
+			__atomic_store_n(&slots[i].false_positives, 0, __ATOMIC_RELAXED);
+		}
+	}
+	if (bits_per_key > 0)
+		result = tree->filter_stats != NULL && RebuildFilter(tree, bits_per_key);
+	else
+		if (tree->filter != NULL) {
+			LookupFilterPtrT filter = tree->filter;
+			__atomic_store_n(&tree->filter, NULL, __ATOMIC_RELEASE);
+			ReleaseFilter(tree, filter);
+		}
+	EndWrite(tree);
+	return result;
+}
+
+//       ; -1,   
+
+extern double LSQ_GetLookupFilterFalsePositiveRate(LSQ_HandleT handle){
+	TreePtrT tree = (TreePtrT)handle;
+	FilterStatSlotPtrT slots = NULL;
+	unsigned long negatives = 0, false_positives = 0;
+	int i;
+	if (tree == LSQ_HandleInvalid || __atomic_load_n(&tree->filter, __ATOMIC_ACQUIRE) == NULL)
+		return -1;
+	slots = (FilterStatSlotPtrT)(((uintptr_t)tree->filter_stats + 63) & ~(uintptr_t)63);
+	for (i = 0; i < FILTER_STAT_SLOTS; i++) {
+		negatives += __atomic_load_n(&slots[i].negatives, __ATOMIC_RELAXED);
+		false_positives += __atomic_load_n(&slots[i].false_positives, __ATOMIC_RELAXED);
+	}
+	return negatives + false_positives == 0 ? 0 : (double)false_positives / (negatives + false_positives);
+}
+
+extern LSQ_HandleT LSQ_CreateJournaledSequence(const char* path, int window_ms){
+#ifdef LSQ_HAVE_PTHREADS
+	TreePtrT tree = NULL;
+	int fd = open(path, O_RDWR | O_CREAT | O_APPEND, 0644);
+	if (fd < 0)
+		return LSQ_HandleInvalid;
+	tree = (TreePtrT)LSQ_CreateSequence();
+	if (tree == LSQ_HandleInvalid){
+		close(fd);
+		return LSQ_HandleInvalid;
+	}
+	tree->journal = ReplayJournal(tree, fd) ? OpenJournal(path, fd, window_ms > 0 ? window_ms : 0) : NULL;
+	if (tree->journal == NULL){
+		close(fd);
+		LSQ_DestroySequence(tree);
+		return LSQ_HandleInvalid;
+	}
+	return tree;
+#else
+	return LSQ_HandleInvalid;
+#endif
+}
+
+//         .  0     (errno)
+
+extern int LSQ_SyncJournal(LSQ_HandleT handle){
+#ifdef LSQ_HAVE_PTHREADS
+	TreePtrT tree = (TreePtrT)handle;
+	if (tree != LSQ_HandleInvalid && tree->journal != NULL)
+		return SyncJournal(tree->journal);
+#endif
+	return 0;
+}
+
+extern int LSQ_CheckpointJournal(LSQ_HandleT handle){
+#ifdef LSQ_HAVE_PTHREADS
+	TreePtrT tree = (TreePtrT)handle;
+	JournalPtrT journal = NULL;
+	LSQ_IteratorT iter = NULL;
+	unsigned char* buffer = NULL;
+	char* temp_path = NULL;
+	size_t used = 0;
+	int fd, success = 1;
+	if (tree == LSQ_HandleInvalid || tree->journal == NULL)
+		return 0;
+	journal = tree->journal;
+	SyncJournal(journal);
+	buffer = (unsigned char*)malloc(JOURNAL_BUFFER_SIZE);
+	temp_path = (char*)malloc(strlen(journal->path) + 5);
+	iter = LSQ_GetFrontElement(handle);
+	if (buffer == NULL || temp_path == NULL || iter == LSQ_IteratorInvalid){
+		free(buffer);
+		free(temp_path);
+		LSQ_DestroyIterator(iter);
+		return 0;
+	}
+	strcpy(temp_path, journal->path);
+	strcat(temp_path, ".tmp");
+	fd = open(temp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	for (; fd >= 0 && success && !LSQ_IsIteratorPastRear(iter); LSQ_AdvanceOneElement(iter)) {
+		EncodeJournalRecord(buffer + used, JOURNAL_RECORD_INSERT, LSQ_GetIteratorKey(iter), LSQ_GetIteratorValue(iter));
+		used += JOURNAL_RECORD_SIZE;
+		if (used + JOURNAL_RECORD_SIZE > JOURNAL_BUFFER_SIZE) {
+			success = WriteAll(fd, buffer, used);
+			used = 0;
+		}
+	}
+	LSQ_DestroyIterator(iter);
+	success = fd >= 0 && success && (used == 0 || WriteAll(fd, buffer, used)) && fsync(fd) == 0;
+	free(buffer);
+	if (fd >= 0)
+		close(fd);
+	if (success)
+		success = rename(temp_path, journal->path) == 0 && SyncDirectoryOf(journal->path);
+	if (success){
+		fd = open(journal->path, O_RDWR | O_APPEND);
+		success = fd >= 0;
+	}
+	if (success){
+		pthread_mutex_lock(&journal->lock);
+		close(journal->fd);
+		journal->fd = fd;
+		if (journal->error != 0) {
+			journal->error = 0;
+			journal->committed = journal->appended - journal->used / JOURNAL_RECORD_SIZE;
+		}
+		pthread_mutex_unlock(&journal->lock);
+	}
+	else
+		unlink(temp_path);
+	free(temp_path);
+	return success;
+#else
+	return 0;
+#endif
 }
 
 extern LSQ_IntegerIndexT LSQ_GetSize(LSQ_HandleT handle){
@@ -220,25 +1225,66 @@ extern int LSQ_IsIteratorBeforeFirst(LSQ_IteratorT iterator){
 }
 
 extern LSQ_BaseTypeT* LSQ_DereferenceIterator(LSQ_IteratorT iterator){
-	if (iterator == LSQ_IteratorInvalid && ((IteratorPtrT)iterator)->node == NULL)
+	IteratorPtrT iter = (IteratorPtrT)iterator;
+	if (!LSQ_IsIteratorDereferencable(iter))
+		return NULL;
+	if (iter->tree->snapshot != NULL || iter->tree->lock != NULL)
 		return NULL;
-	return &(((IteratorPtrT)iterator)->node->value);
+	return &(iter->node->value);
+}
+
+//       ;    ,    , 
+//  LSQ_DereferenceIterator  NULL (    LSQ_UpsertElement). 
+//    0
+extern LSQ_BaseTypeT LSQ_GetIteratorValue(LSQ_IteratorT iterator){
+	IteratorPtrT iter = (IteratorPtrT)iterator;
+	if (!LSQ_IsIteratorDereferencable(iter))
+		return 0;
+	if (iter->tree->snapshot != NULL)
+		return iter->tree->records[iter->position - 1].value;
+	return __atomic_load_n(&iter->node->value, __ATOMIC_RELAXED);
 }
 
 extern LSQ_IntegerIndexT LSQ_GetIteratorKey(LSQ_IteratorT iterator){
-	if (iterator == LSQ_IteratorInvalid && ((IteratorPtrT)iterator)->node == NULL)
+	IteratorPtrT iter = (IteratorPtrT)iterator;
+	if (!LSQ_IsIteratorDereferencable(iter))
 		return -1;
-	return ((IteratorPtrT)iterator)->node->key;
+	if (iter->tree->snapshot != NULL)
+		return iter->tree->records[iter->position - 1].key;
+	return iter->node->key;
 }
           
 extern LSQ_IteratorT LSQ_GetElementByIndex(LSQ_HandleT handle, LSQ_IntegerIndexT index){
 	TreePtrT tree = (TreePtrT)handle;
 	TreeNodePtrT node = NULL;
+	IteratorPtrT iter = NULL;
 	if (tree == NULL)
 		return NULL;
+#ifdef LSQ_HAVE_PTHREADS
+	if (tree->lock != NULL) {
+		LSQ_EpochEnter();
+		if (!FilterRejects(tree, index) && (node = FindNodeConcurrently(tree, &index, 0, NULL)) == NULL)
+			CountFilterFalsePositive(tree);
+		iter = node != NULL ? CreateIterator(handle, node, IT_DEREFERENCABLE) : LSQ_GetPastRearElement(handle);
+		LSQ_EpochExit();
+		return iter;
+	}
+#endif
+	if (FilterRejects(tree, index))
+		return LSQ_GetPastRearElement(handle);
+	if (tree->snapshot != NULL){
+		iter = CreateIterator(handle, NULL, IT_DEREFERENCABLE);
+		if (iter != LSQ_IteratorInvalid && (iter->position = GetSnapshotPositionByKey(tree, index)) == 0) {
+			iter->type = IT_PASTREAR;
+			CountFilterFalsePositive(tree);
+		}
+		return iter;
+	}
 	node = GetNodeByKey(tree->root, index);
-	if (node == NULL)
+	if (node == NULL) {
+		CountFilterFalsePositive(tree);
 		return LSQ_GetPastRearElement(handle);
+	}
 	return CreateIterator(handle, node, IT_DEREFERENCABLE);
 }
 
@@ -255,7 +1301,14 @@ extern LSQ_IteratorT LSQ_GetPastRearElement(LSQ_HandleT handle){
 }
 
 extern void LSQ_DestroyIterator(LSQ_IteratorT iterator){
-	free(iterator);
+	IteratorPtrT iter = (IteratorPtrT)iterator;
+	if (iter == LSQ_IteratorInvalid)
+		return;
+#ifdef LSQ_HAVE_PTHREADS
+	if (iter->tree != LSQ_HandleInvalid && iter->tree->lock != NULL)
+		LSQ_EpochExit();
+#endif
+	LSQ_ArenaFree(iter->arena, iter);
 }
 
 extern void LSQ_AdvanceOneElement(LSQ_IteratorT iterator) {
@@ -263,11 +1316,23 @@ extern void LSQ_AdvanceOneElement(LSQ_IteratorT iterator) {
 	IteratorPtrT iter = (IteratorPtrT) iterator;
 	if (iter == LSQ_IteratorInvalid || iter->type == IT_PASTREAR)
 		return;
+	if (iter->tree->snapshot != NULL) {
+		iter->position = iter->type == IT_BEFOREFIRST ? GetSnapshotFirst(iter->tree) : GetSnapshotNext(iter->tree, iter->position);
+		iter->type = iter->position == 0 ? IT_PASTREAR : IT_DEREFERENCABLE;
+		return;
+	}
+#ifdef LSQ_HAVE_PTHREADS
+	if (iter->tree->lock != NULL) {
+		iter->node = FindNodeConcurrently(iter->tree, iter->type == IT_BEFOREFIRST ? NULL : &iter->node->key, 1, NULL);
+		iter->type = iter->node == NULL ? IT_PASTREAR : IT_DEREFERENCABLE;
+		return;
+	}
+#endif
 	if (iter->type == IT_BEFOREFIRST) {
 		if (iter->tree->root == NULL) 
 			iter->type = IT_PASTREAR;
 		else {
-			iter->node = GetTreeMinimum(iter->tree->root);
+			iter->node = Tree_Minimum(iter->tree->root);
 			iter->type = IT_DEREFERENCABLE;
         }
         return;
@@ -286,7 +1351,7 @@ extern void LSQ_AdvanceOneElement(LSQ_IteratorT iterator) {
 			iter->node = node;
 		else 
 			if (node->right != NULL) 
-				iter->node = GetTreeMinimum(node->right);
+				iter->node = Tree_Minimum(node->right);
 
 }
 
@@ -295,11 +1360,23 @@ extern void LSQ_RewindOneElement(LSQ_IteratorT iterator) {
 	TreeNodePtrT parent = NULL, node = NULL;
 	if (iter == LSQ_IteratorInvalid || iter->type == IT_BEFOREFIRST)
 		return;
+	if (iter->tree->snapshot != NULL) {
+		iter->position = iter->type == IT_PASTREAR ? GetSnapshotLast(iter->tree) : GetSnapshotPrevious(iter->tree, iter->position);
+		iter->type = iter->position == 0 ? IT_BEFOREFIRST : IT_DEREFERENCABLE;
+		return;
+	}
+#ifdef LSQ_HAVE_PTHREADS
+	if (iter->tree->lock != NULL) {
+		iter->node = FindNodeConcurrently(iter->tree, iter->type == IT_PASTREAR ? NULL : &iter->node->key, -1, NULL);
+		iter->type = iter->node == NULL ? IT_BEFOREFIRST : IT_DEREFERENCABLE;
+		return;
+	}
+#endif
 	if (iter->type == IT_PASTREAR) {
 		if (iter->tree->root == NULL) 
 			iter->type = IT_BEFOREFIRST;
 		else {
-			iter->node = GetTreeMaximum(iter->tree->root);
+			iter->node = Tree_Maximum(iter->tree->root);
 			iter->type = IT_DEREFERENCABLE;
         }
         return;
@@ -318,7 +1395,7 @@ extern void LSQ_RewindOneElement(LSQ_IteratorT iterator) {
 			iter->node = node;
 		else 
 			if (node->left != NULL)
-				iter->node = GetTreeMaximum(node->left);
+				iter->node = Tree_Maximum(node->left);
 }
 
 extern void LSQ_ShiftPosition(LSQ_IteratorT iterator, LSQ_IntegerIndexT shift){
@@ -336,19 +1413,25 @@ extern void LSQ_SetPosition(LSQ_IteratorT iterator, LSQ_IntegerIndexT pos){
 	LSQ_ShiftPosition(iterator, pos + 1);
 }
 
-extern void LSQ_InsertElement(LSQ_HandleT handle, LSQ_IntegerIndexT key, LSQ_BaseTypeT value){
-	TreePtrT tree = NULL;
+//  :     key,     value,    
+
+static TreeNodePtrT FindOrInsertNode(TreePtrT tree, LSQ_IntegerIndexT key, LSQ_BaseTypeT value, int* inserted){
 	TreeNodePtrT node = NULL, parent = NULL;
-	if (handle == LSQ_HandleInvalid)
-		return;
-	tree = (TreePtrT) handle;
+	*inserted = 0;
 	if (tree->root == NULL) { 
-		tree->root = CreateNode(key, value, NULL);
+		node = CreateNode(tree, key, value, NULL);
+		if (node == NULL)
+			return NULL;
+		MarkTreeChanging(tree);
+		SetNodeLink(&tree->root, node);
 		tree->size++;
-		return;
+		*inserted = 1;
+		NoteInsertedKey(tree, key);
+		return tree->root;
 	} 
 	parent = tree->root;
 	while (1) {
+		LSQ_STAT_ADD(descent_depth, 1);
 		if (key < parent->key) {
 			if (parent->left == NULL) 
 				break;
@@ -360,68 +1443,289 @@ extern void LSQ_InsertElement(LSQ_HandleT handle, LSQ_IntegerIndexT key, LSQ_Bas
 					break;
 				parent = parent->right;
 			}
-			else {
-				parent->value = value;
-				return;
-			}
+			else
+				return parent;
 	}
-	node = CreateNode(key, value, parent);
+	node = CreateNode(tree, key, value, parent);
 	if (node == NULL)
-		return;
+		return NULL;
 	tree->size++;
+	*inserted = 1;
+	MarkNodeChanging(tree, parent);
 	if (key < parent->key)
-		parent->left = node;
+		SetNodeLink(&parent->left, node);
 	else
-		parent->right = node;
-	Balance(tree, parent, 0);
+		SetNodeLink(&parent->right, node);
+	Tree_Balance(tree, parent, 0);
+	NoteInsertedKey(tree, key);
+	return node;
 }
 
-extern void LSQ_DeleteElement(LSQ_HandleT handle, LSQ_IntegerIndexT key){
-    TreePtrT tree = (TreePtrT)handle;
-    TreeNodePtrT node = NULL, left = NULL, parent = NULL;
-    int new_key;
-    if (tree == NULL || tree->root == NULL)
-        return;
-    node = GetNodeByKey(tree->root, key);
-    if (node == NULL)
-        return;
-    parent = node->parent;
-    if (node->left == NULL && node->right == NULL)
-        ReplaceNode(tree, node, NULL);
-    else 
-		if (node->left != NULL && node->right != NULL) {
-			left = GetTreeMinimum(node->right);
-			new_key = left->key;
-			node->value = left->value;
-			LSQ_DeleteElement(handle, left->key);
-			node->key = new_key;
-			return;
-		}
-        else 
-			if (node->left != NULL)
-				ReplaceNode(tree, node, node->left);
-			else 
-				if (node->right != NULL)
-					ReplaceNode(tree, node, node->right);
-    free(node);
+static int InsertNode(TreePtrT tree, LSQ_IntegerIndexT key, LSQ_BaseTypeT value){
+	int inserted;
+	TreeNodePtrT node = FindOrInsertNode(tree, key, value, &inserted);
+	if (node == NULL)
+		return 0;
+	if (!inserted) {
+		MarkNodeChanging(tree, node);
+		__atomic_store_n(&node->value, value, __ATOMIC_RELAXED);
+	}
+	return 1;
+}
+
+//         (    ), 
+// ,    ,  
+
+static void UnlinkNode(TreePtrT tree, TreeNodePtrT node){
+	Tree_Unlink(tree, node);
+	NoteDeletedKey(tree, node->key);
+	ReleaseNode(tree, node);
 	tree->size--;
-	Balance(tree, parent, 1);
+}
+
+static int DeleteNodeByKey(TreePtrT tree, LSQ_IntegerIndexT key){
+	TreeNodePtrT node = NULL;
+	if (tree->root == NULL)
+		return 0;
+	node = GetNodeByKey(tree->root, key);
+	if (node == NULL)
+		return 0;
+	UnlinkNode(tree, node);
+	return 1;
+}
+
+extern void LSQ_InsertElement(LSQ_HandleT handle, LSQ_IntegerIndexT key, LSQ_BaseTypeT value){
+	TreePtrT tree = (TreePtrT)handle;
+	LSQ_STAT_TIMER(start);
+	if (tree == LSQ_HandleInvalid || tree->snapshot != NULL)
+		return;
+	BeginWrite(tree);
+	if (InsertNode(tree, key, value))
+		AppendJournalRecord(tree, JOURNAL_RECORD_INSERT, key, value);
+	EndWrite(tree);
+	LSQ_STAT_LATENCY(start);
+}
+
+extern void LSQ_DeleteElement(LSQ_HandleT handle, LSQ_IntegerIndexT key){
+	TreePtrT tree = (TreePtrT)handle;
+	LSQ_STAT_TIMER(start);
+	if (tree == LSQ_HandleInvalid || tree->snapshot != NULL)
+		return;
+	BeginWrite(tree);
+	if (DeleteNodeByKey(tree, key))
+		AppendJournalRecord(tree, JOURNAL_RECORD_DELETE, key, 0);
+	EndWrite(tree);
+	LSQ_STAT_LATENCY(start);
 }
 
 
+static void DeleteNode(TreePtrT tree, TreeNodePtrT node){
+	LSQ_IntegerIndexT key = node->key;
+	UnlinkNode(tree, node);
+	AppendJournalRecord(tree, JOURNAL_RECORD_DELETE, key, 0);
+}
+
 extern void LSQ_DeleteFrontElement(LSQ_HandleT handle){
-	LSQ_IteratorT iter = LSQ_GetFrontElement(handle);
-	if (handle == LSQ_HandleInvalid || iter == LSQ_IteratorInvalid)
+	TreePtrT tree = (TreePtrT)handle;
+	LSQ_STAT_TIMER(start);
+	if (tree == LSQ_HandleInvalid || tree->snapshot != NULL)
 		return;
-	LSQ_DeleteElement(handle, LSQ_GetIteratorKey(iter));
-	LSQ_DestroyIterator(iter);
+	BeginWrite(tree);
+	if (tree->root != NULL)
+		DeleteNode(tree, Tree_Minimum(tree->root));
+	EndWrite(tree);
+	LSQ_STAT_LATENCY(start);
 }
 
 extern void LSQ_DeleteRearElement(LSQ_HandleT handle){
-	LSQ_IteratorT iter = LSQ_GetPastRearElement(handle);
-	if (handle == LSQ_HandleInvalid || iter == LSQ_IteratorInvalid)
+	TreePtrT tree = (TreePtrT)handle;
+	LSQ_STAT_TIMER(start);
+	if (tree == LSQ_HandleInvalid || tree->snapshot != NULL)
 		return;
-	LSQ_RewindOneElement(iter);
-	LSQ_DeleteElement(handle, LSQ_GetIteratorKey(iter));
-	LSQ_DestroyIterator(iter);
+	BeginWrite(tree);
+	if (tree->root != NULL)
+		DeleteNode(tree, Tree_Maximum(tree->root));
+	EndWrite(tree);
+	LSQ_STAT_LATENCY(start);
+}
+
+//  ,    ,      .  
+//          ,     
+
+extern void LSQ_DeleteGivenElement(LSQ_IteratorT iterator){
+	IteratorPtrT iter = (IteratorPtrT)iterator;
+	TreeNodePtrT node = NULL;
+	LSQ_STAT_TIMER(start);
+	if (!LSQ_IsIteratorDereferencable(iter) || iter->tree->snapshot != NULL)
+		return;
+#ifdef LSQ_HAVE_PTHREADS
+	if (iter->tree->lock != NULL) {
+		LSQ_DeleteElement(iter->tree, iter->node->key);
+		LSQ_AdvanceOneElement(iter);
+		return;
+	}
+#endif
+	BeginWrite(iter->tree);
+	node = iter->node;
+	iter->node = Tree_Next(node);
+	if (iter->node == NULL)
+		iter->type = IT_PASTREAR;
+	DeleteNode(iter->tree, node);
+	EndWrite(iter->tree);
+	LSQ_STAT_LATENCY(start);
+}
+
+//       key;    ,     value.
+//  inserted (  NULL) ,   
+
+extern LSQ_IteratorT LSQ_InsertOrGetElement(LSQ_HandleT handle, LSQ_IntegerIndexT key, LSQ_BaseTypeT value, int* inserted){
+	TreePtrT tree = (TreePtrT)handle;
+	IteratorPtrT iter = NULL;
+	int created = 0;
+	LSQ_STAT_TIMER(start);
+	if (tree == LSQ_HandleInvalid || tree->snapshot != NULL)
+		return LSQ_IteratorInvalid;
+	iter = CreateIterator(handle, NULL, IT_DEREFERENCABLE);
+	if (iter == LSQ_IteratorInvalid)
+		return LSQ_IteratorInvalid;
+	BeginWrite(tree);
+	iter->node = FindOrInsertNode(tree, key, value, &created);
+	if (created)
+		AppendJournalRecord(tree, JOURNAL_RECORD_INSERT, key, value);
+	EndWrite(tree);
+	if (inserted != NULL)
+		*inserted = created;
+	if (iter->node == NULL) {
+		LSQ_DestroyIterator(iter);
+		iter = LSQ_IteratorInvalid;
+	}
+	LSQ_STAT_LATENCY(start);
+	return iter;
+}
+
+//      : update    (NULL,    ) 
+//  .    ,        
+
+extern void LSQ_UpsertElement(LSQ_HandleT handle, LSQ_IntegerIndexT key, LSQ_BaseTypeT (*update)(const LSQ_BaseTypeT* value, void* arg), void* arg){
+	TreePtrT tree = (TreePtrT)handle;
+	TreeNodePtrT node = NULL;
+	int inserted = 0;
+	LSQ_STAT_TIMER(start);
+	if (tree == LSQ_HandleInvalid || tree->snapshot != NULL || update == NULL)
+		return;
+	BeginWrite(tree);
+	node = FindOrInsertNode(tree, key, 0, &inserted);
+	if (node != NULL) {
+		MarkNodeChanging(tree, node);
+		__atomic_store_n(&node->value, update(inserted ? NULL : &node->value, arg), __ATOMIC_RELAXED);
+		AppendJournalRecord(tree, JOURNAL_RECORD_INSERT, key, node->value);
+	}
+	EndWrite(tree);
+	LSQ_STAT_LATENCY(start);
+}
+
+static int CollectTreePieces(TreeNodePtrT node, int depth, TreePiecePtrT pieces, int count){
+	if (node == NULL)
+		return count;
+	if (depth == 0) {
+		pieces[count].node = node;
+		pieces[count].whole_subtree = 1;
+		return count + 1;
+	}
+	count = CollectTreePieces(node->left, depth - 1, pieces, count);
+	pieces[count].node = node;
+	pieces[count].whole_subtree = 0;
+	return CollectTreePieces(node->right, depth - 1, pieces, count + 1);
+}
+
+static LSQ_BaseTypeT VisitTreeNode(TreeParallelJobPtrT job, TreeNodePtrT node, LSQ_BaseTypeT result){
+	if (job->action != NULL)
+		job->action(node->key, &node->value, job->arg);
+	else if (job->map != NULL)
+		__atomic_store_n(&node->value, job->map(node->key, node->value, job->arg), __ATOMIC_RELAXED);
+	else
+		result = job->combine(result, node->value);
+	return result;
+}
+
+static void RunTreePiece(int index, void* arg){
+	TreeParallelJobPtrT job = (TreeParallelJobPtrT)arg;
+	TreeNodePtrT node = job->pieces[index].node, last = node;
+	LSQ_BaseTypeT result = job->identity;
+	if (job->pieces[index].whole_subtree) {
+		last = Tree_Maximum(node);
+		node = Tree_Minimum(node);
+	}
+	while (1) {
+		result = VisitTreeNode(job, node, result);
+		if (node == last)
+			break;
+		node = Tree_Next(node);
+	}
+	if (job->partials != NULL)
+		job->partials[index] = result;
+}
+
+static void RunTreeParallelJob(TreePtrT tree, TreeParallelJobPtrT job){
+	LSQ_IteratorT iter = NULL;
+	int depth = 2, count, i;
+	if (tree->snapshot != NULL) {
+		for (iter = LSQ_GetFrontElement(tree); iter != NULL && !LSQ_IsIteratorPastRear(iter); LSQ_AdvanceOneElement(iter))
+			job->identity = job->combine(job->identity, LSQ_GetIteratorValue(iter));
+		LSQ_DestroyIterator(iter);
+		return;
+	}
+	while ((1 << depth) < 4 * LSQ_GetParallelThreads() && depth < 16)
+		depth++;
+	job->pieces = (TreePiecePtrT)malloc(sizeof(TreePieceT) * ((2 << depth) - 1));
+	if (job->pieces == NULL)
+		return;
+	if (job->combine != NULL)
+		BeginRead(tree);
+	else {
+		BeginWrite(tree);
+		MarkTreeChanging(tree);
+	}
+	count = CollectTreePieces(tree->root, depth, job->pieces, 0);
+	if (job->combine != NULL)
+		job->partials = (LSQ_BaseTypeT*)malloc(sizeof(LSQ_BaseTypeT) * (count > 0 ? count : 1));
+	if (job->combine == NULL || job->partials != NULL)
+		LSQ_ParallelRun(RunTreePiece, job, count);
+	if (job->combine != NULL)
+		EndRead(tree);
+	else
+		EndWrite(tree);
+	if (job->partials != NULL)
+		for (i = 0; i < count; i++)
+			job->identity = job->combine(job->identity, job->partials[i]);
+	free(job->partials);
+	free(job->pieces);
+}
+
+extern void LSQ_ParallelForEach(LSQ_HandleT handle, void (*action)(LSQ_IntegerIndexT key, LSQ_BaseTypeT* value, void* arg), void* arg){
+	TreeParallelJobT job = { NULL, NULL, NULL, NULL, 0, NULL, NULL };
+	if (handle == LSQ_HandleInvalid || action == NULL || ((TreePtrT)handle)->snapshot != NULL)
+		return;
+	job.action = action;
+	job.arg = arg;
+	RunTreeParallelJob((TreePtrT)handle, &job);
+}
+
+extern void LSQ_ParallelTransform(LSQ_HandleT handle, LSQ_BaseTypeT (*map)(LSQ_IntegerIndexT key, LSQ_BaseTypeT value, void* arg), void* arg){
+	TreeParallelJobT job = { NULL, NULL, NULL, NULL, 0, NULL, NULL };
+	if (handle == LSQ_HandleInvalid || map == NULL || ((TreePtrT)handle)->snapshot != NULL)
+		return;
+	job.map = map;
+	job.arg = arg;
+	RunTreeParallelJob((TreePtrT)handle, &job);
+}
+
+extern LSQ_BaseTypeT LSQ_ParallelReduce(LSQ_HandleT handle, LSQ_BaseTypeT identity, LSQ_BaseTypeT (*combine)(LSQ_BaseTypeT left, LSQ_BaseTypeT right)){
+	TreeParallelJobT job = { NULL, NULL, NULL, NULL, 0, NULL, NULL };
+	if (handle == LSQ_HandleInvalid || combine == NULL)
+		return identity;
+	job.combine = combine;
+	job.identity = identity;
+	RunTreeParallelJob((TreePtrT)handle, &job);
+	return job.identity;
 }
@@ -1,84 +1,433 @@
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+
 #include "linear_sequence.h"
+#include "lsq_stats.h"
+#include "lsq_parallel.h"
+#include "lsq_arena.h"
 #include <string.h>
 
-#define CONTAINER_INITIAL_SIZE 1;
-#define PROPORTIONALITY_FACTOR 2;
-#define LIMIT_OF_CAPACITY 0.25;
+#if defined(__unix__) || defined(__APPLE__)
+#define LSQ_HAVE_MMAP
+#define LSQ_HAVE_PTHREADS
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sched.h>
+#include <pthread.h>
+#if !defined(MAP_ANONYMOUS) && defined(MAP_ANON)
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+#endif
+
+#if defined(__linux__)
+#define LSQ_HAVE_FUTEX
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+
+#define CONTAINER_INITIAL_SIZE 1
+#define PROPORTIONALITY_FACTOR 2
+#define LIMIT_OF_CAPACITY 0.25
+
+#ifndef LSQ_INLINE_CAPACITY
+#define LSQ_INLINE_CAPACITY 8
+#endif
+
+#ifndef LSQ_LARGE_STORAGE_THRESHOLD
+#define LSQ_LARGE_STORAGE_THRESHOLD (4 << 20)
+#endif
+
+#define HUGE_PAGE_SIZE (2 << 20)
+
+#define MAPPED_FILE_MAGIC 0x4D51534C
+#define MAPPED_FILE_VERSION 1
+
+#define QUEUE_CACHE_LINE 64
+
+typedef struct {
+	int magic;
+	int version;
+	int size;
+	int capacity;
+}	MappedHeaderT, *MappedHeaderPtrT;
 
 typedef struct {
 	LSQ_BaseTypeT* data;
 	int physical_size;
 	int logical_size;
+	MappedHeaderPtrT header;
+	int fd;
+	LSQ_ArenaT arena;
+	double growth_factor;
+	double shrink_threshold;
+	size_t large_threshold;
+	size_t large_length;
+	LSQ_BaseTypeT inline_data[LSQ_INLINE_CAPACITY];
 }	ArrayT, *ArrayPtrT;
 
 
 typedef struct {
 	ArrayPtrT handle;
 	LSQ_IntegerIndexT index;
+	LSQ_ArenaT arena;
 }	IteratorT, *IteratorPtrT;
 
+typedef struct {
+	unsigned long sequence;
+	LSQ_BaseTypeT value;
+}	QueueCellT, *QueueCellPtrT;
+
+typedef struct {
+	QueueCellPtrT cells;
+	unsigned long mask;
+	char padding0[QUEUE_CACHE_LINE];
+	unsigned long enqueue_position;
+	char padding1[QUEUE_CACHE_LINE - sizeof(unsigned long)];
+	unsigned long dequeue_position;
+	char padding2[QUEUE_CACHE_LINE - sizeof(unsigned long)];
+	int not_empty;
+	int empty_waiters;
+	int not_full;
+	int full_waiters;
+#if !defined(LSQ_HAVE_FUTEX) && defined(LSQ_HAVE_PTHREADS)
+	pthread_mutex_t event_lock;
+	pthread_cond_t event_changed;
+#endif
+}	QueueT, *QueuePtrT;
+
 static LSQ_IteratorT CreateIterator(LSQ_HandleT h, LSQ_IntegerIndexT index){
 	IteratorPtrT iter = NULL;
 	if (h == LSQ_HandleInvalid)
 		return LSQ_HandleInvalid;
-	iter = (IteratorPtrT) malloc(sizeof(IteratorT));
+	iter = (IteratorPtrT) LSQ_ArenaMalloc(((ArrayPtrT)h)->arena, sizeof(IteratorT));
 	if (iter == NULL)
 		return NULL;
 	iter->handle = (ArrayPtrT)h;
 	iter->index = index;
+	iter->arena = ((ArrayPtrT)h)->arena;
 	return iter;
 }
 
+#ifdef LSQ_HAVE_MMAP
+static size_t MappedFileSize(int capacity){
+	return sizeof(MappedHeaderT) + sizeof(LSQ_BaseTypeT) * capacity;
+}
+
+static int ResizeMappedFile(int fd, size_t length){
+	return ftruncate(fd, length) == 0;
+}
+
+static int RemapStorage(ArrayPtrT h, int capacity){
+	size_t old_length = MappedFileSize(h->logical_size), new_length = MappedFileSize(capacity);
+	void* mapping = NULL;
+	if (!ResizeMappedFile(h->fd, new_length))
+		return 0;
+#ifdef MREMAP_MAYMOVE
+	mapping = mremap(h->header, old_length, new_length, MREMAP_MAYMOVE);
+#else
+	mapping = mmap(NULL, new_length, PROT_READ | PROT_WRITE, MAP_SHARED, h->fd, 0);
+	if (mapping != MAP_FAILED)
+		munmap(h->header, old_length);
+#endif
+	if (mapping == MAP_FAILED){
+		(void)ResizeMappedFile(h->fd, old_length);
+		return 0;
+	}
+	h->header = (MappedHeaderPtrT)mapping;
+	h->header->capacity = capacity;
+	h->data = (LSQ_BaseTypeT*)(h->header + 1);
+	h->logical_size = capacity;
+	return 1;
+}
+
+static size_t LargeStorageLength(int capacity){
+	return (sizeof(LSQ_BaseTypeT) * (size_t)capacity + HUGE_PAGE_SIZE - 1) & ~(size_t)(HUGE_PAGE_SIZE - 1);
+}
+
+static void* MapLargeStorage(size_t length){
+	void* mapping = MAP_FAILED;
+#if defined(LSQ_USE_HUGETLB) && defined(MAP_HUGETLB)
+	mapping = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+#endif
+	if (mapping == MAP_FAILED)
+		mapping = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (mapping == MAP_FAILED)
+		return NULL;
+#ifdef MADV_HUGEPAGE
+	madvise(mapping, length, MADV_HUGEPAGE);
+#endif
+	return mapping;
+}
+
+static int ResizeLargeStorage(ArrayPtrT h, int capacity){
+	size_t length = LargeStorageLength(capacity);
+	void* mapping = NULL;
+	if (length == h->large_length)
+		return 1;
+	LSQ_STAT_ADD(reallocs, 1);
+	if (h->large_length != 0){
+#ifdef MREMAP_MAYMOVE
+		mapping = mremap(h->data, h->large_length, length, MREMAP_MAYMOVE);
+		if (mapping == MAP_FAILED)
+			return 0;
+#ifdef MADV_HUGEPAGE
+		madvise(mapping, length, MADV_HUGEPAGE);
+#endif
+#else
+		mapping = MapLargeStorage(length);
+		if (mapping == NULL)
+			return 0;
+		memcpy(mapping, h->data, sizeof(LSQ_BaseTypeT) * h->physical_size);
+		munmap(h->data, h->large_length);
+#endif
+	}
+	else {
+		mapping = MapLargeStorage(length);
+		if (mapping == NULL)
+			return 0;
+		memcpy(mapping, h->data, sizeof(LSQ_BaseTypeT) * h->physical_size);
+		if (h->data != h->inline_data)
+			free(h->data);
+	}
+	h->data = (LSQ_BaseTypeT*)mapping;
+	h->large_length = length;
+	h->logical_size = length / sizeof(LSQ_BaseTypeT) > 0x7FFFFFFF ? 0x7FFFFFFF : (int)(length / sizeof(LSQ_BaseTypeT));
+	return 1;
+}
+
+static int ReleaseLargeStorage(ArrayPtrT h, int capacity){
+	LSQ_BaseTypeT* data = NULL;
+	if (capacity > LSQ_INLINE_CAPACITY){
+		data = (LSQ_BaseTypeT*)malloc(sizeof(LSQ_BaseTypeT) * capacity);
+		if (data == NULL)
+			return 0;
+	}
+	else {
+		data = h->inline_data;
+		capacity = LSQ_INLINE_CAPACITY;
+	}
+	LSQ_STAT_ADD(reallocs, 1);
+	memcpy(data, h->data, sizeof(LSQ_BaseTypeT) * h->physical_size);
+	munmap(h->data, h->large_length);
+	h->data = data;
+	h->large_length = 0;
+	h->logical_size = capacity;
+	return 1;
+}
+#endif
+
+static int ResizeStorage(ArrayPtrT h, int capacity){
+	LSQ_BaseTypeT* data = NULL;
+#ifdef LSQ_HAVE_MMAP
+	if (h->header != NULL){
+		LSQ_STAT_ADD(reallocs, 1);
+		return RemapStorage(h, capacity);
+	}
+	if (h->arena == LSQ_ArenaInvalid && h->large_threshold > 0 && sizeof(LSQ_BaseTypeT) * (size_t)capacity >= h->large_threshold)
+		return ResizeLargeStorage(h, capacity);
+	if (h->large_length != 0)
+		return ReleaseLargeStorage(h, capacity);
+#endif
+	if (h->arena != LSQ_ArenaInvalid && capacity < h->logical_size)
+		return 1;
+	if (capacity <= LSQ_INLINE_CAPACITY){
+		if (h->data != h->inline_data){
+			LSQ_STAT_ADD(reallocs, 1);
+			memcpy(h->inline_data, h->data, sizeof(LSQ_BaseTypeT) * h->physical_size);
+			LSQ_ArenaFree(h->arena, h->data);
+			h->data = h->inline_data;
+			h->logical_size = LSQ_INLINE_CAPACITY;
+		}
+		return 1;
+	}
+	LSQ_STAT_ADD(reallocs, 1);
+	if (h->data == h->inline_data){
+		data = (LSQ_BaseTypeT*)LSQ_ArenaMalloc(h->arena, sizeof(LSQ_BaseTypeT) * capacity);
+		if (data != NULL)
+			memcpy(data, h->inline_data, sizeof(LSQ_BaseTypeT) * h->physical_size);
+	}
+	else
+		data = (LSQ_BaseTypeT*)LSQ_ArenaRealloc(h->arena, h->data, sizeof(LSQ_BaseTypeT) * h->logical_size, sizeof(LSQ_BaseTypeT) * capacity);
+	if (data == NULL)
+		return 0;
+	h->data = data;
+	h->logical_size = capacity;
+	return 1;
+}
+
+static int GrownCapacity(ArrayPtrT h){
+	double capacity = h->logical_size * h->growth_factor;
+	return capacity >= 0x7FFFFFFF ? 0x7FFFFFFF : ((int)capacity > h->logical_size ? (int)capacity : h->logical_size + 1);
+}
+
 static void InsertElementAtIndex(LSQ_HandleT handle, LSQ_IntegerIndexT index, LSQ_BaseTypeT element){
 	ArrayPtrT h = (ArrayPtrT)handle;
 	LSQ_BaseTypeT* PlaceOfElement = NULL;
+	LSQ_STAT_TIMER(start);
 	if(h == NULL) 
 		return;
-	if(h->physical_size == h->logical_size){
-		h->logical_size *= PROPORTIONALITY_FACTOR;
-		h->data = (LSQ_BaseTypeT*)realloc(h->data, sizeof(LSQ_BaseTypeT) * h->logical_size);
-	}	
+	if(h->physical_size == h->logical_size && !ResizeStorage(h, GrownCapacity(h)))
+		return;
 	PlaceOfElement = h->data + index;
 	memmove(PlaceOfElement + 1, PlaceOfElement, sizeof(LSQ_BaseTypeT) * (h->physical_size - index));	
+	LSQ_STAT_ADD(bytes_moved, sizeof(LSQ_BaseTypeT) * (h->physical_size - index));
 	*PlaceOfElement = element;
 	h->physical_size++;
+	if (h->header != NULL)
+		h->header->size = h->physical_size;
+	LSQ_STAT_LATENCY(start);
 }
 
 static void DeleteElementAtIndex(LSQ_HandleT handle, LSQ_IntegerIndexT index){
 	ArrayPtrT h = (ArrayPtrT)handle;
-	int For_Condition_Constant;
+	int For_Condition_Constant, new_capacity;
 	LSQ_BaseTypeT* PlaceOfElement = NULL;
+	LSQ_STAT_TIMER(start);
 	if(h == NULL) 
 		return;
-	For_Condition_Constant = h->logical_size * LIMIT_OF_CAPACITY;
+	For_Condition_Constant = h->logical_size * h->shrink_threshold;
 	if(h->physical_size <  For_Condition_Constant){
-		h->logical_size /= PROPORTIONALITY_FACTOR;
-		if (h->logical_size == 0)
-			h->logical_size = CONTAINER_INITIAL_SIZE;
-		h->data = (LSQ_BaseTypeT*)realloc(h->data, sizeof(LSQ_BaseTypeT) * h->logical_size);
+		new_capacity = h->logical_size / h->growth_factor;
+		if (new_capacity <= h->physical_size)
+			new_capacity = h->physical_size + 1;
+		if (new_capacity == 0)
+			new_capacity = CONTAINER_INITIAL_SIZE;
+		ResizeStorage(h, new_capacity);
 	}
 	if (h->physical_size > 0){
 		PlaceOfElement = h->data + index;
-		memmove(PlaceOfElement , PlaceOfElement + 1, sizeof(LSQ_BaseTypeT) * (h->physical_size - index));	
+		memmove(PlaceOfElement , PlaceOfElement + 1, sizeof(LSQ_BaseTypeT) * (h->physical_size - index - 1));	
+		LSQ_STAT_ADD(bytes_moved, sizeof(LSQ_BaseTypeT) * (h->physical_size - index - 1));
 		h->physical_size--;
 	}
+	if (h->header != NULL)
+		h->header->size = h->physical_size;
+	LSQ_STAT_LATENCY(start);
 }
 
-extern LSQ_HandleT LSQ_CreateSequence(void){
-	ArrayPtrT h = (ArrayPtrT)malloc(sizeof(ArrayT));
+static LSQ_HandleT InitSequence(ArrayPtrT h, LSQ_ArenaT arena){
 	if (h == LSQ_HandleInvalid)
 		return LSQ_HandleInvalid;
-	h->data = (LSQ_BaseTypeT*)malloc(sizeof(LSQ_BaseTypeT));
+	h->data = h->inline_data;
 	h->physical_size = 0;
-	h->logical_size = CONTAINER_INITIAL_SIZE; 
+	h->logical_size = LSQ_INLINE_CAPACITY; 
+	h->header = NULL;
+	h->fd = -1;
+	h->arena = arena;
+	h->growth_factor = PROPORTIONALITY_FACTOR;
+	h->shrink_threshold = LIMIT_OF_CAPACITY;
+	h->large_threshold = LSQ_LARGE_STORAGE_THRESHOLD;
+	h->large_length = 0;
+	return h;
+}
+
+extern LSQ_HandleT LSQ_CreateSequenceInArena(LSQ_ArenaT arena){
+	return InitSequence((ArrayPtrT)LSQ_ArenaMalloc(arena, sizeof(ArrayT)), arena);
+}
+
+extern LSQ_HandleT LSQ_CreateSequence(void){
+	return LSQ_CreateSequenceInArena(LSQ_ArenaInvalid);
+}
+
+extern LSQ_HandleT LSQ_CreateMappedSequence(const char* path){
+#ifdef LSQ_HAVE_MMAP
+	ArrayPtrT h = NULL;
+	MappedHeaderPtrT header = NULL;
+	struct stat st;
+	size_t length;
+	int fd = open(path, O_RDWR | O_CREAT, 0644);
+	if (fd < 0)
+		return LSQ_HandleInvalid;
+	if (fstat(fd, &st) != 0 || (st.st_size > 0 && (size_t)st.st_size < sizeof(MappedHeaderT))){
+		close(fd);
+		return LSQ_HandleInvalid;
+	}
+	length = st.st_size > 0 ? (size_t)st.st_size : MappedFileSize(CONTAINER_INITIAL_SIZE);
+	if (st.st_size == 0 && ftruncate(fd, length) != 0){
+		close(fd);
+		return LSQ_HandleInvalid;
+	}
+	header = (MappedHeaderPtrT)mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if ((void*)header == MAP_FAILED){
+		close(fd);
+		return LSQ_HandleInvalid;
+	}
+	if (st.st_size == 0){
+		header->magic = MAPPED_FILE_MAGIC;
+		header->version = MAPPED_FILE_VERSION;
+		header->size = 0;
+		header->capacity = CONTAINER_INITIAL_SIZE;
+	}
+	if (header->magic != MAPPED_FILE_MAGIC || header->version != MAPPED_FILE_VERSION || header->capacity <= 0 ||
+		header->size < 0 || header->size > header->capacity || MappedFileSize(header->capacity) != length){
+		munmap(header, length);
+		close(fd);
+		return LSQ_HandleInvalid;
+	}
+	h = (ArrayPtrT)malloc(sizeof(ArrayT));
+	if (h == LSQ_HandleInvalid){
+		munmap(header, length);
+		close(fd);
+		return LSQ_HandleInvalid;
+	}
+	h->header = header;
+	h->fd = fd;
+	h->arena = LSQ_ArenaInvalid;
+	h->growth_factor = PROPORTIONALITY_FACTOR;
+	h->shrink_threshold = LIMIT_OF_CAPACITY;
+	h->large_threshold = 0;
+	h->large_length = 0;
+	h->data = (LSQ_BaseTypeT*)(header + 1);
+	h->physical_size = header->size;
+	h->logical_size = header->capacity;
 	return h;
+#else
+	return LSQ_HandleInvalid;
+#endif
+}
+
+extern void LSQ_SyncMappedSequence(LSQ_HandleT handle){
+#ifdef LSQ_HAVE_MMAP
+	ArrayPtrT h = (ArrayPtrT)handle;
+	if (h != LSQ_HandleInvalid && h->header != NULL)
+		msync(h->header, MappedFileSize(h->logical_size), MS_SYNC);
+#endif
 }
 
 extern void LSQ_DestroySequence(LSQ_HandleT handle){
-	if (handle != LSQ_HandleInvalid){
-		free(((ArrayPtrT)handle)->data);
-		free(handle);
+	ArrayPtrT h = (ArrayPtrT)handle;
+	if (h == LSQ_HandleInvalid)
+		return;
+#ifdef LSQ_HAVE_MMAP
+	if (h->header != NULL){
+		munmap(h->header, MappedFileSize(h->logical_size));
+		close(h->fd);
 	}
+	else if (h->large_length != 0)
+		munmap(h->data, h->large_length);
+	else
+#endif
+	if (h->data != h->inline_data)
+		LSQ_ArenaFree(h->arena, h->data);
+	LSQ_ArenaFree(h->arena, h);
+}
+
+extern int LSQ_SetGrowthPolicy(LSQ_HandleT handle, double growth_factor, double shrink_threshold){
+	ArrayPtrT h = (ArrayPtrT)handle;
+	if (h == LSQ_HandleInvalid || growth_factor <= 1 || shrink_threshold < 0 || shrink_threshold * growth_factor >= 1)
+		return 0;
+	h->growth_factor = growth_factor;
+	h->shrink_threshold = shrink_threshold;
+	return 1;
+}
+
+extern void LSQ_SetLargeStorageThreshold(LSQ_HandleT handle, size_t bytes){
+	ArrayPtrT h = (ArrayPtrT)handle;
+	if (h != LSQ_HandleInvalid)
+		h->large_threshold = bytes;
 }
 
 extern LSQ_IntegerIndexT LSQ_GetSize(LSQ_HandleT handle){
@@ -119,7 +468,8 @@ extern LSQ_IteratorT LSQ_GetPastRearElement(LSQ_HandleT handle){
 }
 
 extern void LSQ_DestroyIterator(LSQ_IteratorT iterator){
-	free(iterator);
+	if (iterator != NULL)
+		LSQ_ArenaFree(((IteratorPtrT)iterator)->arena, iterator);
 }
 
 extern void LSQ_AdvanceOneElement(LSQ_IteratorT iterator){
@@ -177,3 +527,258 @@ extern void LSQ_DeleteGivenElement(LSQ_IteratorT iterator){
 		return;
 	DeleteElementAtIndex(iter->handle, iter->index);
 }
+
+extern LSQ_BaseTypeT* LSQ_GetRangeSpan(LSQ_HandleT handle, LSQ_IntegerIndexT first, LSQ_IntegerIndexT count, LSQ_IntegerIndexT* length){
+	ArrayPtrT h = (ArrayPtrT)handle;
+	if (length != NULL)
+		*length = 0;
+	if (h == LSQ_HandleInvalid || first < 0 || count <= 0 || first >= h->physical_size)
+		return NULL;
+	if (count > h->physical_size - first)
+		count = h->physical_size - first;
+	if (length != NULL)
+		*length = count;
+	return h->data + first;
+}
+
+extern LSQ_BaseTypeT* LSQ_GetSpan(LSQ_HandleT handle, LSQ_IntegerIndexT* length){
+	return LSQ_GetRangeSpan(handle, 0, LSQ_GetSize(handle), length);
+}
+
+static void WaitQueueEvent(QueuePtrT q, int* event, int value){
+#ifdef LSQ_HAVE_FUTEX
+	(void)q;
+	syscall(SYS_futex, event, FUTEX_WAIT_PRIVATE, value, NULL, NULL, 0);
+#elif defined(LSQ_HAVE_PTHREADS)
+	pthread_mutex_lock(&q->event_lock);
+	while (__atomic_load_n(event, __ATOMIC_SEQ_CST) == value)
+		pthread_cond_wait(&q->event_changed, &q->event_lock);
+	pthread_mutex_unlock(&q->event_lock);
+#else
+	(void)q;
+	(void)event;
+	(void)value;
+#endif
+}
+
+static void SignalQueueEvent(QueuePtrT q, int* event, int* waiters){
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (__atomic_load_n(waiters, __ATOMIC_SEQ_CST) == 0)
+		return;
+	__atomic_add_fetch(event, 1, __ATOMIC_SEQ_CST);
+#ifdef LSQ_HAVE_FUTEX
+	(void)q;
+	syscall(SYS_futex, event, FUTEX_WAKE_PRIVATE, __INT32_MAX__, NULL, NULL, 0);
+#elif defined(LSQ_HAVE_PTHREADS)
+	pthread_mutex_lock(&q->event_lock);
+	pthread_cond_broadcast(&q->event_changed);
+	pthread_mutex_unlock(&q->event_lock);
+#else
+	(void)q;
+#endif
+}
+
+static LSQ_IntegerIndexT EnqueueCells(QueuePtrT q, const LSQ_BaseTypeT* elements, LSQ_IntegerIndexT count){
+	unsigned long position = __atomic_load_n(&q->enqueue_position, __ATOMIC_RELAXED);
+	LSQ_IntegerIndexT claimed, i;
+	while (1) {
+		for (claimed = 0; claimed < count && claimed <= (LSQ_IntegerIndexT)q->mask; claimed++)
+			if (__atomic_load_n(&q->cells[(position + claimed) & q->mask].sequence, __ATOMIC_ACQUIRE) != position + claimed)
+				break;
+		if (claimed == 0) {
+			if ((long)(__atomic_load_n(&q->cells[position & q->mask].sequence, __ATOMIC_ACQUIRE) - position) < 0)
+				return 0;
+			position = __atomic_load_n(&q->enqueue_position, __ATOMIC_RELAXED);
+			continue;
+		}
+		if (__atomic_compare_exchange_n(&q->enqueue_position, &position, position + claimed, 1, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+			break;
+	}
+	for (i = 0; i < claimed; i++) {
+		q->cells[(position + i) & q->mask].value = elements[i];
+		__atomic_store_n(&q->cells[(position + i) & q->mask].sequence, position + i + 1, __ATOMIC_RELEASE);
+	}
+	SignalQueueEvent(q, &q->not_empty, &q->empty_waiters);
+	return claimed;
+}
+
+static LSQ_IntegerIndexT DequeueCells(QueuePtrT q, LSQ_BaseTypeT* elements, LSQ_IntegerIndexT count){
+	unsigned long position = __atomic_load_n(&q->dequeue_position, __ATOMIC_RELAXED);
+	LSQ_IntegerIndexT claimed, i;
+	while (1) {
+		for (claimed = 0; claimed < count && claimed <= (LSQ_IntegerIndexT)q->mask; claimed++)
+			if (__atomic_load_n(&q->cells[(position + claimed) & q->mask].sequence, __ATOMIC_ACQUIRE) != position + claimed + 1)
+				break;
+		if (claimed == 0) {
+			if ((long)(__atomic_load_n(&q->cells[position & q->mask].sequence, __ATOMIC_ACQUIRE) - (position + 1)) < 0)
+				return 0;
+			position = __atomic_load_n(&q->dequeue_position, __ATOMIC_RELAXED);
+			continue;
+		}
+		if (__atomic_compare_exchange_n(&q->dequeue_position, &position, position + claimed, 1, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+			break;
+	}
+	for (i = 0; i < claimed; i++) {
+		elements[i] = q->cells[(position + i) & q->mask].value;
+		__atomic_store_n(&q->cells[(position + i) & q->mask].sequence, position + i + q->mask + 1, __ATOMIC_RELEASE);
+	}
+	SignalQueueEvent(q, &q->not_full, &q->full_waiters);
+	return claimed;
+}
+
+extern LSQ_HandleT LSQ_CreateQueue(LSQ_IntegerIndexT capacity){
+	QueuePtrT q = NULL;
+	unsigned long size = 1, i;
+	while (size < (unsigned long)capacity)
+		size <<= 1;
+	q = (QueuePtrT)calloc(1, sizeof(QueueT));
+	if (q == NULL)
+		return LSQ_HandleInvalid;
+	q->cells = (QueueCellPtrT)malloc(sizeof(QueueCellT) * size);
+	if (q->cells == NULL) {
+		free(q);
+		return LSQ_HandleInvalid;
+	}
+	for (i = 0; i < size; i++)
+		q->cells[i].sequence = i;
+	q->mask = size - 1;
+#if !defined(LSQ_HAVE_FUTEX) && defined(LSQ_HAVE_PTHREADS)
+	pthread_mutex_init(&q->event_lock, NULL);
+	pthread_cond_init(&q->event_changed, NULL);
+#endif
+	return q;
+}
+
+extern void LSQ_DestroyQueue(LSQ_HandleT handle){
+	if (handle == LSQ_HandleInvalid)
+		return;
+#if !defined(LSQ_HAVE_FUTEX) && defined(LSQ_HAVE_PTHREADS)
+	pthread_mutex_destroy(&((QueuePtrT)handle)->event_lock);
+	pthread_cond_destroy(&((QueuePtrT)handle)->event_changed);
+#endif
+	free(((QueuePtrT)handle)->cells);
+	free(handle);
+}
+
+extern LSQ_IntegerIndexT LSQ_TryEnqueueBatch(LSQ_HandleT handle, const LSQ_BaseTypeT* elements, LSQ_IntegerIndexT count){
+	return (handle != LSQ_HandleInvalid && count > 0) ? EnqueueCells((QueuePtrT)handle, elements, count) : 0;
+}
+
+extern LSQ_IntegerIndexT LSQ_TryDequeueBatch(LSQ_HandleT handle, LSQ_BaseTypeT* elements, LSQ_IntegerIndexT count){
+	return (handle != LSQ_HandleInvalid && count > 0) ? DequeueCells((QueuePtrT)handle, elements, count) : 0;
+}
+
+extern int LSQ_TryEnqueue(LSQ_HandleT handle, LSQ_BaseTypeT element){
+	return LSQ_TryEnqueueBatch(handle, &element, 1) == 1;
+}
+
+extern int LSQ_TryDequeue(LSQ_HandleT handle, LSQ_BaseTypeT* element){
+	return LSQ_TryDequeueBatch(handle, element, 1) == 1;
+}
+
+extern void LSQ_Enqueue(LSQ_HandleT handle, LSQ_BaseTypeT element){
+	QueuePtrT q = (QueuePtrT)handle;
+	int event;
+	if (q == LSQ_HandleInvalid)
+		return;
+	while (!EnqueueCells(q, &element, 1)) {
+		__atomic_add_fetch(&q->full_waiters, 1, __ATOMIC_SEQ_CST);
+		event = __atomic_load_n(&q->not_full, __ATOMIC_SEQ_CST);
+		if (EnqueueCells(q, &element, 1)) {
+			__atomic_sub_fetch(&q->full_waiters, 1, __ATOMIC_SEQ_CST);
+			return;
+		}
+		WaitQueueEvent(q, &q->not_full, event);
+		__atomic_sub_fetch(&q->full_waiters, 1, __ATOMIC_SEQ_CST);
+	}
+}
+
+extern void LSQ_Dequeue(LSQ_HandleT handle, LSQ_BaseTypeT* element){
+	QueuePtrT q = (QueuePtrT)handle;
+	int event;
+	if (q == LSQ_HandleInvalid)
+		return;
+	while (!DequeueCells(q, element, 1)) {
+		__atomic_add_fetch(&q->empty_waiters, 1, __ATOMIC_SEQ_CST);
+		event = __atomic_load_n(&q->not_empty, __ATOMIC_SEQ_CST);
+		if (DequeueCells(q, element, 1)) {
+			__atomic_sub_fetch(&q->empty_waiters, 1, __ATOMIC_SEQ_CST);
+			return;
+		}
+		WaitQueueEvent(q, &q->not_empty, event);
+		__atomic_sub_fetch(&q->empty_waiters, 1, __ATOMIC_SEQ_CST);
+	}
+}
+
+typedef struct {
+	ArrayPtrT handle;
+	void (*action)(LSQ_BaseTypeT* element, void* arg);
+	LSQ_BaseTypeT (*map)(LSQ_BaseTypeT element, void* arg);
+	LSQ_BaseTypeT (*combine)(LSQ_BaseTypeT left, LSQ_BaseTypeT right);
+	LSQ_BaseTypeT identity;
+	LSQ_BaseTypeT* partials;
+	void* arg;
+}	ParallelJobT, *ParallelJobPtrT;
+
+static void RunParallelChunk(int chunk, void* arg){
+	ParallelJobPtrT job = (ParallelJobPtrT)arg;
+	LSQ_BaseTypeT* element = job->handle->data + (LSQ_IntegerIndexT)chunk * LSQ_PARALLEL_CHUNK;
+	LSQ_BaseTypeT* end = job->handle->data + job->handle->physical_size;
+	LSQ_BaseTypeT result = job->identity;
+	if (end - element > LSQ_PARALLEL_CHUNK)
+		end = element + LSQ_PARALLEL_CHUNK;
+	for (; element < end; element++)
+		if (job->action != NULL)
+			job->action(element, job->arg);
+		else if (job->map != NULL)
+			*element = job->map(*element, job->arg);
+		else
+			result = job->combine(result, *element);
+	if (job->partials != NULL)
+		job->partials[chunk] = result;
+}
+
+static int RunParallelJob(LSQ_HandleT handle, ParallelJobPtrT job){
+	if (handle == LSQ_HandleInvalid)
+		return 0;
+	job->handle = (ArrayPtrT)handle;
+	LSQ_ParallelRun(RunParallelChunk, job, (job->handle->physical_size + LSQ_PARALLEL_CHUNK - 1) / LSQ_PARALLEL_CHUNK);
+	return 1;
+}
+
+extern void LSQ_ParallelForEach(LSQ_HandleT handle, void (*action)(LSQ_BaseTypeT* element, void* arg), void* arg){
+	ParallelJobT job = { NULL, NULL, NULL, NULL, 0, NULL, NULL };
+	if (action == NULL)
+		return;
+	job.action = action;
+	job.arg = arg;
+	RunParallelJob(handle, &job);
+}
+
+extern void LSQ_ParallelTransform(LSQ_HandleT handle, LSQ_BaseTypeT (*map)(LSQ_BaseTypeT element, void* arg), void* arg){
+	ParallelJobT job = { NULL, NULL, NULL, NULL, 0, NULL, NULL };
+	if (map == NULL)
+		return;
+	job.map = map;
+	job.arg = arg;
+	RunParallelJob(handle, &job);
+}
+
+extern LSQ_BaseTypeT LSQ_ParallelReduce(LSQ_HandleT handle, LSQ_BaseTypeT identity, LSQ_BaseTypeT (*combine)(LSQ_BaseTypeT left, LSQ_BaseTypeT right)){
+	ParallelJobT job = { NULL, NULL, NULL, NULL, 0, NULL, NULL };
+	LSQ_BaseTypeT result = identity;
+	int chunks, i;
+	if (handle == LSQ_HandleInvalid || combine == NULL)
+		return identity;
+	chunks = (((ArrayPtrT)handle)->physical_size + LSQ_PARALLEL_CHUNK - 1) / LSQ_PARALLEL_CHUNK;
+	job.combine = combine;
+	job.identity = identity;
+	job.partials = (LSQ_BaseTypeT*)malloc(sizeof(LSQ_BaseTypeT) * (chunks > 0 ? chunks : 1));
+	if (job.partials == NULL)
+		return identity;
+	RunParallelJob(handle, &job);
+	for (i = 0; i < chunks; i++)
+		result = combine(result, job.partials[i]);
+	free(job.partials);
+	return result;
+}
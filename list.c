@@ -1,4 +1,15 @@
 ﻿#include "linear_sequence.h"
+#include "lsq_stats.h"
+#include "lsq_epoch.h"
+#include "lsq_reclaim.h"
+#include "lsq_arena.h"
+#include "lsq_generic.h"
+#include <stdint.h>
+
+/* Младший бит указателя next в параллельном списке означает, что элемент логически удалён */
+#define IS_MARKED(p) (((uintptr_t)(p)) & 1)
+#define MARKED(p) ((ConcurrentElementPtrT)(((uintptr_t)(p)) | 1))
+#define UNMARKED(p) ((ConcurrentElementPtrT)(((uintptr_t)(p)) & ~(uintptr_t)1))
 
 typedef struct ListItemT {
 	LSQ_BaseTypeT data;
@@ -6,45 +17,84 @@ typedef struct ListItemT {
 	struct ListItemT* prev;
 } ListElementT, *ListElementPtrT;
 
+/* Связывание элементов общее с LSQ_DEFINE_LIST из lsq_generic.h */
+LSQ_DEFINE_LIST_LINKS(List, ListElementT)
+
 typedef struct {
 	int size;
 	ListElementPtrT before_first;
 	ListElementPtrT past_rear;
+	LSQ_ArenaT arena;
 } ListT, *ListPtrT;
 
 typedef struct {
 	ListPtrT handle;
 	ListElementPtrT element;
+	LSQ_ArenaT arena;
 } ListIteratorT, *ListIteratorPtrT;
 
+typedef struct ConcurrentItemT {
+	LSQ_BaseTypeT data;
+	struct ConcurrentItemT* next;
+} ConcurrentElementT, *ConcurrentElementPtrT;
+
+typedef struct {
+	ConcurrentElementT head;
+	int size;
+} ConcurrentListT, *ConcurrentListPtrT;
+
+/* Функция, освобождающая не более budget элементов с начала списка (при budget < 0 - все). Когда элементов не  *
+ * остаётся, освобождает и сам список и возвращает 1                                                             */
+static int FreeElements(ListPtrT handle, LSQ_IntegerIndexT budget){
+	ListElementPtrT e = handle->before_first->next, next = NULL;
+	if (handle->arena != LSQ_ArenaInvalid)
+		return 1;
+	while (e != handle->past_rear && budget-- != 0){
+		next = e->next;
+		free(e);
+		e = next;
+	}
+	handle->before_first->next = e;
+	if (e != handle->past_rear)
+		return 0;
+	free(handle->before_first);
+	free(handle->past_rear);
+	free(handle);
+	return 1;
+}
+
 static LSQ_IteratorT CreateIterator(LSQ_HandleT handle,  ListElementPtrT element){
 	ListIteratorPtrT iter = NULL;
 	if (handle == LSQ_HandleInvalid || element == NULL)
 		return NULL;
-	iter = (ListIteratorPtrT)malloc(sizeof(ListIteratorT));
+	iter = (ListIteratorPtrT)LSQ_ArenaMalloc(((ListPtrT)handle)->arena, sizeof(ListIteratorT));
 	if (iter == NULL)
 		return NULL;
 	iter->element = element;
 	iter->handle = (ListPtrT)handle;
+	iter->arena = ((ListPtrT)handle)->arena;
 	return iter;
 }
 
-/* Функция, создающая пустой контейнер. Возвращает назначенный ему дескриптор */
-extern LSQ_HandleT LSQ_CreateSequence(void){
-	ListPtrT handle = (ListPtrT)malloc(sizeof(ListT));
+/* Функция, создающая пустой контейнер в арене arena (LSQ_ArenaInvalid - в куче). Элементы и итераторы такого    *
+ * контейнера размещаются в арене, а его уничтожение выполняется за O(1)                                         */
+extern LSQ_HandleT LSQ_CreateSequenceInArena(LSQ_ArenaT arena){
+	ListPtrT handle = (ListPtrT)LSQ_ArenaMalloc(arena, sizeof(ListT));
 	if (handle == LSQ_HandleInvalid)
 		return LSQ_HandleInvalid;
-	handle->before_first = (ListElementPtrT)malloc(sizeof(ListElementT));
+	handle->before_first = (ListElementPtrT)LSQ_ArenaMalloc(arena, sizeof(ListElementT));
 	if (handle->before_first == NULL){
-		free(handle);
+		LSQ_ArenaFree(arena, handle);
 		return LSQ_HandleInvalid;
 	}
-	handle->past_rear = (ListElementPtrT)malloc(sizeof(ListElementT));
+	handle->past_rear = (ListElementPtrT)LSQ_ArenaMalloc(arena, sizeof(ListElementT));
 	if (handle->past_rear == NULL){
-		free(handle->before_first);
-		free(handle);
+		LSQ_ArenaFree(arena, handle->before_first);
+		LSQ_ArenaFree(arena, handle);
 		return LSQ_HandleInvalid;		
 	}
+	LSQ_STAT_ADD(node_allocations, 2);
+	handle->arena = arena;
 	handle->size = 0;
 	handle->before_first->next = handle->past_rear;
 	handle->before_first->prev = NULL;
@@ -53,19 +103,30 @@ extern LSQ_HandleT LSQ_CreateSequence(void){
 	return handle;
 }
 
+/* Функция, создающая пустой контейнер. Возвращает назначенный ему дескриптор */
+extern LSQ_HandleT LSQ_CreateSequence(void){
+	return LSQ_CreateSequenceInArena(LSQ_ArenaInvalid);
+}
+
 /* Функция, уничтожающая контейнер с заданным дескриптором. Освобождает принадлежащую ему память */
 extern void LSQ_DestroySequence(LSQ_HandleT handle){
-	ListIteratorPtrT iter = (ListIteratorPtrT)LSQ_GetFrontElement(handle);
-	if (iter == NULL)
-		return;
-	while (!LSQ_IsIteratorPastRear(iter)){
-		free(iter->element->prev);
-		LSQ_AdvanceOneElement(iter);
-	}
-	free(iter->element->prev);
-	free(iter->element);
-	free(iter->handle);
-	LSQ_DestroyIterator(iter);
+	if (handle != LSQ_HandleInvalid)
+		FreeElements((ListPtrT)handle, -1);
+}
+
+/* Функция, выполняющая часть уничтожения контейнера: освобождает не более budget элементов. Возвращает 1, когда  *
+ * контейнер уничтожен полностью. После первого вызова контейнер можно передавать только этой функции.           */
+extern int LSQ_DestroySequenceStep(LSQ_HandleT handle, LSQ_IntegerIndexT budget){
+	return (handle != LSQ_HandleInvalid) ? FreeElements((ListPtrT)handle, budget > 0 ? budget : 1) : 1;
+}
+
+static int DestroyStep(void* handle, int budget){
+	return LSQ_DestroySequenceStep(handle, budget);
+}
+
+/* Функция, передающая контейнер на уничтожение фоновому потоку */
+extern void LSQ_DestroySequenceInBackground(LSQ_HandleT handle){
+	LSQ_ReclaimInBackground(handle, DestroyStep);
 }
 
 /* Функция, возвращающая текущее количество элементов в контейнере */
@@ -124,7 +185,8 @@ extern LSQ_IteratorT LSQ_GetPastRearElement(LSQ_HandleT handle){
 
 /* Функция, уничтожающая итератор с заданным дескриптором и освобождающая принадлежащую ему память */
 extern void LSQ_DestroyIterator(LSQ_IteratorT iterator){
-	free(iterator);
+	if (iterator != NULL)
+		LSQ_ArenaFree(((ListIteratorPtrT)iterator)->arena, iterator);
 }
 
 /* Функция, перемещающая итератор на один элемент вперед */
@@ -140,7 +202,7 @@ extern void LSQ_RewindOneElement(LSQ_IteratorT iterator){
 /* Функция, перемещающая итератор на заданное смещение со знаком */
 extern void LSQ_ShiftPosition(LSQ_IteratorT iterator, LSQ_IntegerIndexT shift){
 	ListIteratorPtrT iter = (ListIteratorPtrT)iterator;
-	int i;
+	int i, j;
 	if (iter == NULL)
 		return;
 	for (i = 0; i < shift; i++){
@@ -148,11 +210,12 @@ extern void LSQ_ShiftPosition(LSQ_IteratorT iterator, LSQ_IntegerIndexT shift){
 			break;
 		iter->element = iter->element->next;
 	}
-	for (i = 0; i < abs(shift); i++){
+	for (j = 0; j < -shift; j++){
 		if (iter->element == NULL || LSQ_IsIteratorBeforeFirst(iter))
 			break;
 		iter->element = iter->element->prev;
 	}
+	LSQ_STAT_ADD(traversal_steps, i + j);
 }
 
 /* Функция, устанавливающая итератор на элемент с указанным номером */
@@ -188,19 +251,19 @@ extern void LSQ_InsertRearElement(LSQ_HandleT handle, LSQ_BaseTypeT element){
 extern void LSQ_InsertElementBeforeGiven(LSQ_IteratorT iterator, LSQ_BaseTypeT newElement){
 	ListElementPtrT e = NULL;
 	ListIteratorPtrT iter = NULL;
+	LSQ_STAT_TIMER(start);
 	if(iterator == NULL || LSQ_IsIteratorBeforeFirst(iterator)) 
 		return;
 	iter = (ListIteratorPtrT)iterator;
-	e = (ListElementPtrT)malloc(sizeof(ListElementT));
+	e = (ListElementPtrT)LSQ_ArenaMalloc(iter->handle->arena, sizeof(ListElementT));
 	if (e == NULL)
 		return;
-	e->next = iter->element;
-	e->prev = iter->element->prev;
+	LSQ_STAT_ADD(node_allocations, 1);
 	e->data = newElement;
-	iter->element->prev->next = e;
-	iter->element->prev = e;
+	List_LinkBefore(iter->element, e);
 	iter->element = e;
 	iter->handle->size++;
+	LSQ_STAT_LATENCY(start);
 }
 
 /* Функция, удаляющая первый элемент контейнера */
@@ -224,14 +287,159 @@ extern void LSQ_DeleteRearElement(LSQ_HandleT handle){
 /* Функция, удаляющая элемент контейнера, указываемый заданным итератором. Все последующие элементы смещаются на     *
  * одну позицию в сторону начала.                                                                                    */
 extern void LSQ_DeleteGivenElement(LSQ_IteratorT iterator){
-	ListElementPtrT l = NULL, r = NULL;
+	ListElementPtrT r = NULL;
 	ListIteratorPtrT iter = (ListIteratorPtrT)iterator;
+	LSQ_STAT_TIMER(start);
 	if(iter == NULL || !LSQ_IsIteratorDereferencable(iter)) return;
-	l = iter->element->prev;
-	r = iter->element->next;
-	l->next = r;
-	r->prev = l;
-	free(iter->element);
+	r = List_Unlink(iter->element);
+	LSQ_ArenaFree(iter->handle->arena, iter->element);
 	iter->element = r;
 	iter->handle->size--;
-}
\ No newline at end of file
+	LSQ_STAT_LATENCY(start);
+}
+
+/* Далее - параллельный вариант списка без блокировок. Элементы вставляются сравнением с обменом (CAS), удаляются   *
+ * в два шага: сначала помечается указатель next удаляемого элемента, затем элемент исключается из цепочки тем      *
+ * потоком, который первым его обнаружит. Память освобождается через lsq_epoch. Обход читателями не повторяется и  *
+ * не ждёт других потоков.                                                                                          */
+
+static int InsertAfterConcurrent(ConcurrentElementPtrT prev, ConcurrentElementPtrT e){
+	ConcurrentElementPtrT next = __atomic_load_n(&prev->next, __ATOMIC_ACQUIRE);
+	while (!IS_MARKED(next)) {
+		e->next = next;
+		if (__atomic_compare_exchange_n(&prev->next, &next, e, 0, __ATOMIC_RELEASE, __ATOMIC_ACQUIRE))
+			return 1;
+	}
+	return 0;
+}
+
+/* Функция, ищущая первый не удалённый элемент, равный *value, и попутно исключающая из цепочки помеченные        *
+ * элементы. При value, равном NULL, проходит весь список. В prev записывается последний пройденный элемент      */
+static ConcurrentElementPtrT SearchConcurrent(ConcurrentListPtrT list, LSQ_BaseTypeT* value, ConcurrentElementPtrT* prev){
+	ConcurrentElementPtrT pred = &list->head, curr = NULL, next = NULL;
+	curr = UNMARKED(__atomic_load_n(&pred->next, __ATOMIC_ACQUIRE));
+	while (curr != NULL) {
+		next = __atomic_load_n(&curr->next, __ATOMIC_ACQUIRE);
+		if (IS_MARKED(next)) {
+			if (__atomic_compare_exchange_n(&pred->next, &curr, UNMARKED(next), 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+				LSQ_EpochRetire(curr, free);
+				curr = UNMARKED(next);
+			}
+			else {
+				pred = &list->head;
+				curr = UNMARKED(__atomic_load_n(&pred->next, __ATOMIC_ACQUIRE));
+			}
+			continue;
+		}
+		if (value != NULL && curr->data == *value)
+			break;
+		pred = curr;
+		curr = next;
+	}
+	*prev = pred;
+	return curr;
+}
+
+/* Функция, создающая пустой параллельный список */
+extern LSQ_HandleT LSQ_CreateConcurrentSequence(void){
+	ConcurrentListPtrT list = (ConcurrentListPtrT)malloc(sizeof(ConcurrentListT));
+	if (list == NULL)
+		return LSQ_HandleInvalid;
+	list->head.next = NULL;
+	list->size = 0;
+	return list;
+}
+
+/* Функция, уничтожающая параллельный список. Вызывается, когда другие потоки с ним уже не работают */
+extern void LSQ_DestroyConcurrentSequence(LSQ_HandleT handle){
+	ConcurrentListPtrT list = (ConcurrentListPtrT)handle;
+	ConcurrentElementPtrT e = NULL, next = NULL;
+	if (list == LSQ_HandleInvalid)
+		return;
+	for (e = UNMARKED(list->head.next); e != NULL; e = next) {
+		next = UNMARKED(e->next);
+		free(e);
+	}
+	free(list);
+}
+
+/* Функция, возвращающая число элементов параллельного списка на момент вызова */
+extern LSQ_IntegerIndexT LSQ_ConcurrentGetSize(LSQ_HandleT handle){
+	return (handle != LSQ_HandleInvalid) ? __atomic_load_n(&((ConcurrentListPtrT)handle)->size, __ATOMIC_RELAXED) : -1;
+}
+
+/* Функция, добавляющая элемент в начало параллельного списка */
+extern void LSQ_ConcurrentInsertFrontElement(LSQ_HandleT handle, LSQ_BaseTypeT element){
+	ConcurrentListPtrT list = (ConcurrentListPtrT)handle;
+	ConcurrentElementPtrT e = NULL;
+	if (list == LSQ_HandleInvalid)
+		return;
+	e = (ConcurrentElementPtrT)malloc(sizeof(ConcurrentElementT));
+	if (e == NULL)
+		return;
+	LSQ_STAT_ADD(node_allocations, 1);
+	e->data = element;
+	InsertAfterConcurrent(&list->head, e);
+	__atomic_add_fetch(&list->size, 1, __ATOMIC_RELAXED);
+}
+
+/* Функция, добавляющая элемент в конец параллельного списка. Требует прохода по всему списку */
+extern void LSQ_ConcurrentInsertRearElement(LSQ_HandleT handle, LSQ_BaseTypeT element){
+	ConcurrentListPtrT list = (ConcurrentListPtrT)handle;
+	ConcurrentElementPtrT e = NULL, last = NULL, expected = NULL;
+	if (list == LSQ_HandleInvalid)
+		return;
+	e = (ConcurrentElementPtrT)malloc(sizeof(ConcurrentElementT));
+	if (e == NULL)
+		return;
+	LSQ_STAT_ADD(node_allocations, 1);
+	e->data = element;
+	e->next = NULL;
+	LSQ_EpochEnter();
+	do {
+		SearchConcurrent(list, NULL, &last);
+		expected = NULL;
+	} while (!__atomic_compare_exchange_n(&last->next, &expected, e, 0, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+	LSQ_EpochExit();
+	__atomic_add_fetch(&list->size, 1, __ATOMIC_RELAXED);
+}
+
+/* Функция, удаляющая из параллельного списка первый элемент, равный value. Возвращает 1, если элемент был удалён */
+extern int LSQ_ConcurrentDeleteElement(LSQ_HandleT handle, LSQ_BaseTypeT value){
+	ConcurrentListPtrT list = (ConcurrentListPtrT)handle;
+	ConcurrentElementPtrT prev = NULL, curr = NULL, next = NULL, expected = NULL;
+	if (list == LSQ_HandleInvalid)
+		return 0;
+	LSQ_EpochEnter();
+	while ((curr = SearchConcurrent(list, &value, &prev)) != NULL) {
+		next = __atomic_load_n(&curr->next, __ATOMIC_ACQUIRE);
+		if (IS_MARKED(next) || !__atomic_compare_exchange_n(&curr->next, &next, MARKED(next), 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+			continue;
+		expected = curr;
+		if (__atomic_compare_exchange_n(&prev->next, &expected, next, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+			LSQ_EpochRetire(curr, free);
+		else
+			SearchConcurrent(list, NULL, &prev);
+		break;
+	}
+	LSQ_EpochExit();
+	if (curr == NULL)
+		return 0;
+	__atomic_sub_fetch(&list->size, 1, __ATOMIC_RELAXED);
+	return 1;
+}
+
+/* Функция, вызывающая action для каждого не удалённого элемента параллельного списка */
+extern void LSQ_ConcurrentForEach(LSQ_HandleT handle, void (*action)(LSQ_BaseTypeT* element, void* arg), void* arg){
+	ConcurrentListPtrT list = (ConcurrentListPtrT)handle;
+	ConcurrentElementPtrT e = NULL, next = NULL;
+	if (list == LSQ_HandleInvalid || action == NULL)
+		return;
+	LSQ_EpochEnter();
+	for (e = UNMARKED(__atomic_load_n(&list->head.next, __ATOMIC_ACQUIRE)); e != NULL; e = UNMARKED(next)) {
+		next = __atomic_load_n(&e->next, __ATOMIC_ACQUIRE);
+		if (!IS_MARKED(next))
+			action(&e->data, arg);
+	}
+	LSQ_EpochExit();
+}
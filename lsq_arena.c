@@ -0,0 +1,114 @@
+#include "lsq_arena.h"
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct ArenaBlockT {
+	struct ArenaBlockT* next;
+	size_t size;
+}	ArenaBlockT, *ArenaBlockPtrT;
+
+typedef struct {
+	ArenaBlockPtrT first;
+	ArenaBlockPtrT current;
+	char* position;
+	char* limit;
+	size_t block_size;
+}	ArenaT, *ArenaPtrT;
+
+#define ARENA_ROUND(size) (((size) + LSQ_ARENA_ALIGNMENT - 1) & ~(size_t)(LSQ_ARENA_ALIGNMENT - 1))
+#define ARENA_BLOCK_HEADER ARENA_ROUND(sizeof(ArenaBlockT))
+
+static void UseBlock(ArenaPtrT arena, ArenaBlockPtrT block){
+	arena->current = block;
+	arena->position = (char*)block + ARENA_BLOCK_HEADER;
+	arena->limit = arena->position + block->size;
+}
+
+static ArenaBlockPtrT CreateBlock(size_t size){
+	ArenaBlockPtrT block = (ArenaBlockPtrT)malloc(ARENA_BLOCK_HEADER + size);
+	if (block == NULL)
+		return NULL;
+	block->next = NULL;
+	block->size = size;
+	return block;
+}
+
+extern LSQ_ArenaT LSQ_CreateArena(size_t block_size){
+	ArenaPtrT arena = (ArenaPtrT)malloc(sizeof(ArenaT));
+	if (arena == NULL)
+		return LSQ_ArenaInvalid;
+	arena->block_size = ARENA_ROUND(block_size > 0 ? block_size : LSQ_ARENA_DEFAULT_BLOCK);
+	arena->first = CreateBlock(arena->block_size);
+	if (arena->first == NULL) {
+		free(arena);
+		return LSQ_ArenaInvalid;
+	}
+	UseBlock(arena, arena->first);
+	return arena;
+}
+
+extern void* LSQ_ArenaAlloc(LSQ_ArenaT handle, size_t size){
+	ArenaPtrT arena = (ArenaPtrT)handle;
+	ArenaBlockPtrT block = NULL;
+	char* result = NULL;
+	if (arena == LSQ_ArenaInvalid)
+		return NULL;
+	size = ARENA_ROUND(size > 0 ? size : 1);
+	while ((size_t)(arena->limit - arena->position) < size) {
+		block = arena->current->next;
+		if (block == NULL || block->size < size) {
+			block = CreateBlock(size > arena->block_size ? size : arena->block_size);
+			if (block == NULL)
+				return NULL;
+			block->next = arena->current->next;
+			arena->current->next = block;
+		}
+		UseBlock(arena, block);
+	}
+	result = arena->position;
+	arena->position += size;
+	return result;
+}
+
+extern void* LSQ_ArenaMalloc(LSQ_ArenaT arena, size_t size){
+	return arena != LSQ_ArenaInvalid ? LSQ_ArenaAlloc(arena, size) : malloc(size);
+}
+
+extern void* LSQ_ArenaRealloc(LSQ_ArenaT handle, void* pointer, size_t old_size, size_t new_size){
+	ArenaPtrT arena = (ArenaPtrT)handle;
+	void* result = NULL;
+	if (arena == LSQ_ArenaInvalid)
+		return realloc(pointer, new_size);
+	if (pointer != NULL && (char*)pointer + ARENA_ROUND(old_size) == arena->position &&
+		ARENA_ROUND(new_size) <= (size_t)(arena->limit - (char*)pointer)) {
+		arena->position = (char*)pointer + ARENA_ROUND(new_size);
+		return pointer;
+	}
+	result = LSQ_ArenaAlloc(arena, new_size);
+	if (result != NULL && pointer != NULL)
+		memcpy(result, pointer, old_size < new_size ? old_size : new_size);
+	return result;
+}
+
+extern void LSQ_ArenaFree(LSQ_ArenaT arena, void* pointer){
+	if (arena == LSQ_ArenaInvalid)
+		free(pointer);
+}
+
+extern void LSQ_ResetArena(LSQ_ArenaT handle){
+	ArenaPtrT arena = (ArenaPtrT)handle;
+	if (arena != LSQ_ArenaInvalid)
+		UseBlock(arena, arena->first);
+}
+
+extern void LSQ_DestroyArena(LSQ_ArenaT handle){
+	ArenaPtrT arena = (ArenaPtrT)handle;
+	ArenaBlockPtrT block = NULL, next = NULL;
+	if (arena == LSQ_ArenaInvalid)
+		return;
+	for (block = arena->first; block != NULL; block = next) {
+		next = block->next;
+		free(block);
+	}
+	free(arena);
+}
@@ -0,0 +1,41 @@
+#ifndef LSQ_ARENA_H
+#define LSQ_ARENA_H
+
+#include <stddef.h>
+
+/* Арена - выделение памяти сдвигом указателя внутри крупных блоков. Отдельные объекты не освобождаются; вся     *
+ * память арены возвращается за O(1) вызовом LSQ_ResetArena (блоки остаются за ареной для повторного использования) *
+ * или освобождается LSQ_DestroyArena. Арена не потокобезопасна.                                                    */
+
+#define LSQ_ARENA_ALIGNMENT 16
+#define LSQ_ARENA_DEFAULT_BLOCK 65536
+
+typedef void* LSQ_ArenaT;
+
+#define LSQ_ArenaInvalid NULL
+
+/* Функция, создающая арену с блоками по block_size байт (0 - размер по умолчанию) */
+extern LSQ_ArenaT LSQ_CreateArena(size_t block_size);
+
+/* Функция, выделяющая в арене size байт, выровненных на LSQ_ARENA_ALIGNMENT. Возвращает NULL при нехватке памяти */
+extern void* LSQ_ArenaAlloc(LSQ_ArenaT arena, size_t size);
+
+/* Следующие три функции используются контейнерами, которые могут работать как в арене, так и в куче: при      *
+ * arena == LSQ_ArenaInvalid они вызывают malloc, realloc и free.                                                 */
+/* Функция, выделяющая size байт в арене или в куче */
+extern void* LSQ_ArenaMalloc(LSQ_ArenaT arena, size_t size);
+
+/* Функция, изменяющая размер блока pointer с old_size до new_size байт. Последний выделенный в арене блок       *
+ * расширяется на месте, остальные копируются в новый                                                             */
+extern void* LSQ_ArenaRealloc(LSQ_ArenaT arena, void* pointer, size_t old_size, size_t new_size);
+
+/* Функция, освобождающая блок, выделенный в куче; память арены отдельно не освобождается */
+extern void LSQ_ArenaFree(LSQ_ArenaT arena, void* pointer);
+
+/* Функция, делающая всю выделенную в арене память снова свободной */
+extern void LSQ_ResetArena(LSQ_ArenaT arena);
+
+/* Функция, освобождающая арену вместе со всеми блоками */
+extern void LSQ_DestroyArena(LSQ_ArenaT arena);
+
+#endif
@@ -0,0 +1,150 @@
+#include "lsq_epoch.h"
+#include "lsq_stats.h"
+#include <stdlib.h>
+#include <pthread.h>
+#include <sched.h>
+
+#define EPOCH_CACHE_LINE 64
+
+typedef struct {
+	unsigned long epoch;
+	int in_use;
+	char padding[EPOCH_CACHE_LINE - sizeof(unsigned long) - sizeof(int)];
+}	EpochSlotT;
+
+typedef struct {
+	void* pointer;
+	void (*destroy)(void*);
+	unsigned long epoch;
+}	RetiredT, *RetiredPtrT;
+
+typedef struct EpochBlockT {
+	EpochSlotT slots[LSQ_EPOCH_BLOCK_SLOTS];
+	struct EpochBlockT* next;
+}	EpochBlockT, *EpochBlockPtrT;
+
+typedef struct {
+	EpochSlotT* slot;
+	int depth;
+	RetiredPtrT retired;
+	int retired_count;
+	int retired_capacity;
+}	EpochThreadT;
+
+static EpochBlockT first_block;
+static unsigned long global_epoch = 1;
+static pthread_key_t thread_key;
+static pthread_once_t thread_key_once = PTHREAD_ONCE_INIT;
+static LSQ_THREAD_LOCAL EpochThreadT* current = NULL;
+
+static void ReleaseThread(void* arg){
+	EpochThreadT* thread = (EpochThreadT*)arg;
+	current = thread;
+	LSQ_EpochBarrier();
+	__atomic_store_n(&thread->slot->epoch, 0, __ATOMIC_SEQ_CST);
+	__atomic_store_n(&thread->slot->in_use, 0, __ATOMIC_RELEASE);
+	free(thread->retired);
+	free(thread);
+	current = NULL;
+}
+
+static void CreateThreadKey(void){
+	pthread_key_create(&thread_key, ReleaseThread);
+}
+
+/* Функция, занимающая свободный слот. Если все слоты заняты, в конец цепочки добавляется новый блок, поэтому *
+ * число потоков, одновременно работающих с эпохами, не ограничено                                                */
+static EpochSlotT* AcquireSlot(void){
+	EpochBlockPtrT block = &first_block, next = NULL, fresh = NULL;
+	int i, expected;
+	for (;;) {
+		for (i = 0; i < LSQ_EPOCH_BLOCK_SLOTS; i++) {
+			expected = 0;
+			if (__atomic_compare_exchange_n(&block->slots[i].in_use, &expected, 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+				return block->slots + i;
+		}
+		next = __atomic_load_n(&block->next, __ATOMIC_ACQUIRE);
+		if (next == NULL) {
+			fresh = (EpochBlockPtrT)calloc(1, sizeof(EpochBlockT));
+			if (fresh == NULL)
+				abort();
+			if (__atomic_compare_exchange_n(&block->next, &next, fresh, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+				next = fresh;
+			else
+				free(fresh);
+		}
+		block = next;
+	}
+}
+
+static EpochThreadT* GetThread(void){
+	EpochThreadT* thread = current;
+	if (thread != NULL)
+		return thread;
+	thread = (EpochThreadT*)calloc(1, sizeof(EpochThreadT));
+	if (thread == NULL)
+		abort();
+	thread->slot = AcquireSlot();
+	pthread_once(&thread_key_once, CreateThreadKey);
+	pthread_setspecific(thread_key, thread);
+	current = thread;
+	return thread;
+}
+
+extern void LSQ_EpochEnter(void){
+	EpochThreadT* thread = GetThread();
+	if (thread->depth++ == 0)
+		__atomic_store_n(&thread->slot->epoch, __atomic_load_n(&global_epoch, __ATOMIC_SEQ_CST), __ATOMIC_SEQ_CST);
+}
+
+extern void LSQ_EpochExit(void){
+	EpochThreadT* thread = GetThread();
+	if (--thread->depth == 0)
+		__atomic_store_n(&thread->slot->epoch, 0, __ATOMIC_RELEASE);
+}
+
+extern void LSQ_EpochRetire(void* pointer, void (*destroy)(void*)){
+	EpochThreadT* thread = GetThread();
+	RetiredPtrT retired = NULL;
+	if (thread->retired_count == thread->retired_capacity) {
+		retired = (RetiredPtrT)realloc(thread->retired, sizeof(RetiredT) * (thread->retired_capacity > 0 ? 2 * thread->retired_capacity : LSQ_EPOCH_RECLAIM_THRESHOLD));
+		if (retired == NULL)
+			return;
+		thread->retired = retired;
+		thread->retired_capacity = thread->retired_capacity > 0 ? 2 * thread->retired_capacity : LSQ_EPOCH_RECLAIM_THRESHOLD;
+	}
+	retired = thread->retired + thread->retired_count++;
+	retired->pointer = pointer;
+	retired->destroy = destroy;
+	retired->epoch = __atomic_fetch_add(&global_epoch, 1, __ATOMIC_SEQ_CST);
+	if (thread->retired_count % LSQ_EPOCH_RECLAIM_THRESHOLD == 0)
+		LSQ_EpochReclaim();
+}
+
+extern void LSQ_EpochReclaim(void){
+	EpochThreadT* thread = GetThread();
+	EpochBlockPtrT block = NULL;
+	unsigned long minimum = (unsigned long)-1, epoch;
+	int i, kept = 0;
+	for (block = &first_block; block != NULL; block = __atomic_load_n(&block->next, __ATOMIC_ACQUIRE))
+		for (i = 0; i < LSQ_EPOCH_BLOCK_SLOTS; i++) {
+			epoch = __atomic_load_n(&block->slots[i].epoch, __ATOMIC_SEQ_CST);
+			if (epoch != 0 && epoch < minimum)
+				minimum = epoch;
+		}
+	for (i = 0; i < thread->retired_count; i++)
+		if (thread->retired[i].epoch < minimum)
+			thread->retired[i].destroy(thread->retired[i].pointer);
+		else
+			thread->retired[kept++] = thread->retired[i];
+	thread->retired_count = kept;
+}
+
+extern void LSQ_EpochBarrier(void){
+	EpochThreadT* thread = GetThread();
+	LSQ_EpochReclaim();
+	while (thread->retired_count > 0) {
+		sched_yield();
+		LSQ_EpochReclaim();
+	}
+}
@@ -0,0 +1,29 @@
+#ifndef LSQ_EPOCH_H
+#define LSQ_EPOCH_H
+
+/* Отложенное освобождение памяти для параллельных режимов контейнеров. Поток, читающий разделяемую структуру,     *
+ * находится между LSQ_EpochEnter и LSQ_EpochExit; память, переданная в LSQ_EpochRetire, освобождается лишь после   *
+ * того, как все потоки, которые могли её видеть, вышли из своих критических секций.                                */
+
+#define LSQ_EPOCH_BLOCK_SLOTS 128
+#define LSQ_EPOCH_RECLAIM_THRESHOLD 64
+
+/* Функция, открывающая критическую секцию читателя. Допускает вложенные вызовы */
+extern void LSQ_EpochEnter(void);
+
+/* Функция, закрывающая критическую секцию читателя */
+extern void LSQ_EpochExit(void);
+
+/* Функция, откладывающая вызов destroy(pointer) до момента, когда объект гарантированно недоступен читателям. *
+ * Объект к моменту вызова должен быть уже исключён из разделяемой структуры. Если памяти для учёта объекта нет,  *
+ * он не освобождается никогда.                                                                                   */
+extern void LSQ_EpochRetire(void* pointer, void (*destroy)(void*));
+
+/* Функция, освобождающая те отложенные объекты вызывающего потока, которые уже недоступны читателям */
+extern void LSQ_EpochReclaim(void);
+
+/* Функция, дожидающаяся освобождения всех отложенных объектов вызывающего потока. Вызывается только вне        *
+ * критической секции.                                                                                            */
+extern void LSQ_EpochBarrier(void);
+
+#endif
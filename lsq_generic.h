@@ -0,0 +1,449 @@
+#ifndef LSQ_GENERIC_H
+#define LSQ_GENERIC_H
+
+#include "lsq_arena.h"
+#include <stdlib.h>
+#include <string.h>
+
+/* Макросы, порождающие варианты контейнеров, специализированные под конкретные типы элементов и ключей.          *
+ * Элементы хранятся в узлах и буферах непосредственно, без промежуточных указателей, а сравнение ключей задаётся  *
+ * макросом или функцией Less(a, b) и может быть встроено компилятором. Все функции получают префикс Name_.       *
+ * Связи списка и алгоритмы АВЛ-дерева порождаются отдельными макросами, которые используют и list.c с avl_tree.c, *
+ * поэтому исправление в них действует сразу на обе реализации. Контейнеры, выделяющие память, могут работать в   *
+ * арене (Name_InitInArena), как и соответствующие модули.                                                        */
+
+#if defined(__GNUC__)
+#define LSQ_GENERIC_API static __inline__ __attribute__((unused))
+#else
+#define LSQ_GENERIC_API static
+#endif
+
+#define LSQ_DEFAULT_LESS(a, b) ((a) < (b))
+
+/* Массив фиксированной ёмкости Capacity, целиком размещённый внутри структуры */
+#define LSQ_DEFINE_ARRAY(Name, Type, Capacity) \
+typedef struct { \
+	Type data[Capacity]; \
+	int size; \
+} Name##T; \
+LSQ_GENERIC_API void Name##_Init(Name##T* a){ \
+	a->size = 0; \
+} \
+LSQ_GENERIC_API int Name##_Size(const Name##T* a){ \
+	return a->size; \
+} \
+LSQ_GENERIC_API Type* Name##_At(Name##T* a, int index){ \
+	return (index >= 0 && index < a->size) ? a->data + index : NULL; \
+} \
+LSQ_GENERIC_API int Name##_Insert(Name##T* a, int index, Type element){ \
+	if (a->size == (Capacity) || index < 0 || index > a->size) \
+		return 0; \
+	memmove(a->data + index + 1, a->data + index, sizeof(Type) * (a->size - index)); \
+	a->data[index] = element; \
+	a->size++; \
+	return 1; \
+} \
+LSQ_GENERIC_API void Name##_Delete(Name##T* a, int index){ \
+	if (index < 0 || index >= a->size) \
+		return; \
+	memmove(a->data + index, a->data + index + 1, sizeof(Type) * (a->size - index - 1)); \
+	a->size--; \
+} \
+LSQ_GENERIC_API int Name##_InsertRear(Name##T* a, Type element){ \
+	return Name##_Insert(a, a->size, element); \
+}
+
+/* Динамический массив с удвоением ёмкости. Первые InlineCapacity элементов (0 - без встроенного буфера) хранятся  *
+ * в самой структуре, как inline_data в dyn_array.c, поэтому структуру со встроенным буфером нельзя копировать    *
+ * побайтно. Внешний буфер выделяется в арене, переданной в Name_InitInArena                                      */
+#define LSQ_DEFINE_INLINE_DYN_ARRAY(Name, Type, InlineCapacity) \
+typedef struct { \
+	Type* data; \
+	int size; \
+	int capacity; \
+	LSQ_ArenaT arena; \
+	Type inline_data[(InlineCapacity) > 0 ? (InlineCapacity) : 1]; \
+} Name##T; \
+LSQ_GENERIC_API void Name##_InitInArena(Name##T* a, LSQ_ArenaT arena){ \
+	a->data = (InlineCapacity) > 0 ? a->inline_data : NULL; \
+	a->size = 0; \
+	a->capacity = (InlineCapacity); \
+	a->arena = arena; \
+} \
+LSQ_GENERIC_API void Name##_Init(Name##T* a){ \
+	Name##_InitInArena(a, LSQ_ArenaInvalid); \
+} \
+LSQ_GENERIC_API void Name##_Destroy(Name##T* a){ \
+	if (a->data != a->inline_data) \
+		LSQ_ArenaFree(a->arena, a->data); \
+	Name##_InitInArena(a, a->arena); \
+} \
+LSQ_GENERIC_API int Name##_Size(const Name##T* a){ \
+	return a->size; \
+} \
+LSQ_GENERIC_API Type* Name##_At(Name##T* a, int index){ \
+	return (index >= 0 && index < a->size) ? a->data + index : NULL; \
+} \
+LSQ_GENERIC_API int Name##_Reserve(Name##T* a, int capacity){ \
+	Type* data = NULL; \
+	if (capacity <= a->capacity) \
+		return 1; \
+	if (a->data == a->inline_data) { \
+		data = (Type*)LSQ_ArenaMalloc(a->arena, sizeof(Type) * capacity); \
+		if (data != NULL) \
+			memcpy(data, a->inline_data, sizeof(Type) * a->size); \
+	} \
+	else \
+		data = (Type*)LSQ_ArenaRealloc(a->arena, a->data, sizeof(Type) * a->capacity, sizeof(Type) * capacity); \
+	if (data == NULL) \
+		return 0; \
+	a->data = data; \
+	a->capacity = capacity; \
+	return 1; \
+} \
+LSQ_GENERIC_API int Name##_Insert(Name##T* a, int index, Type element){ \
+	if (index < 0 || index > a->size) \
+		return 0; \
+	if (a->size == a->capacity && !Name##_Reserve(a, a->capacity > 0 ? 2 * a->capacity : 1)) \
+		return 0; \
+	memmove(a->data + index + 1, a->data + index, sizeof(Type) * (a->size - index)); \
+	a->data[index] = element; \
+	a->size++; \
+	return 1; \
+} \
+LSQ_GENERIC_API void Name##_Delete(Name##T* a, int index){ \
+	if (index < 0 || index >= a->size) \
+		return; \
+	memmove(a->data + index, a->data + index + 1, sizeof(Type) * (a->size - index - 1)); \
+	a->size--; \
+} \
+LSQ_GENERIC_API int Name##_InsertRear(Name##T* a, Type element){ \
+	return Name##_Insert(a, a->size, element); \
+}
+
+/* Динамический массив без встроенного буфера */
+#define LSQ_DEFINE_DYN_ARRAY(Name, Type) LSQ_DEFINE_INLINE_DYN_ARRAY(Name, Type, 0)
+
+/* Связи двусвязного списка, общие для LSQ_DEFINE_LIST и list.c. Узел NodeT содержит поля prev и next */
+#define LSQ_DEFINE_LIST_LINKS(Name, NodeT) \
+LSQ_GENERIC_API void Name##_LinkBefore(NodeT* position, NodeT* e){ \
+	e->next = position; \
+	e->prev = position->prev; \
+	position->prev->next = e; \
+	position->prev = e; \
+} \
+LSQ_GENERIC_API NodeT* Name##_Unlink(NodeT* e){ \
+	NodeT* next = e->next; \
+	e->prev->next = next; \
+	next->prev = e->prev; \
+	return next; \
+}
+
+/* Двусвязный список с фиктивным элементом head внутри структуры списка. Name_End возвращает head */
+#define LSQ_DEFINE_LIST(Name, Type) \
+typedef struct Name##NodeT { \
+	struct Name##NodeT* prev; \
+	struct Name##NodeT* next; \
+	Type data; \
+} Name##NodeT; \
+typedef struct { \
+	Name##NodeT head; \
+	int size; \
+	LSQ_ArenaT arena; \
+} Name##T; \
+LSQ_DEFINE_LIST_LINKS(Name, Name##NodeT) \
+LSQ_GENERIC_API void Name##_InitInArena(Name##T* l, LSQ_ArenaT arena){ \
+	l->head.next = &l->head; \
+	l->head.prev = &l->head; \
+	l->size = 0; \
+	l->arena = arena; \
+} \
+LSQ_GENERIC_API void Name##_Init(Name##T* l){ \
+	Name##_InitInArena(l, LSQ_ArenaInvalid); \
+} \
+LSQ_GENERIC_API int Name##_Size(const Name##T* l){ \
+	return l->size; \
+} \
+LSQ_GENERIC_API Name##NodeT* Name##_First(Name##T* l){ \
+	return l->head.next; \
+} \
+LSQ_GENERIC_API Name##NodeT* Name##_End(Name##T* l){ \
+	return &l->head; \
+} \
+LSQ_GENERIC_API Name##NodeT* Name##_InsertBefore(Name##T* l, Name##NodeT* position, Type element){ \
+	Name##NodeT* e = (Name##NodeT*)LSQ_ArenaMalloc(l->arena, sizeof(Name##NodeT)); \
+	if (e == NULL) \
+		return NULL; \
+	e->data = element; \
+	Name##_LinkBefore(position, e); \
+	l->size++; \
+	return e; \
+} \
+LSQ_GENERIC_API Name##NodeT* Name##_InsertFront(Name##T* l, Type element){ \
+	return Name##_InsertBefore(l, l->head.next, element); \
+} \
+LSQ_GENERIC_API Name##NodeT* Name##_InsertRear(Name##T* l, Type element){ \
+	return Name##_InsertBefore(l, &l->head, element); \
+} \
+LSQ_GENERIC_API Name##NodeT* Name##_Delete(Name##T* l, Name##NodeT* e){ \
+	Name##NodeT* next = NULL; \
+	if (e == &l->head) \
+		return e; \
+	next = Name##_Unlink(e); \
+	LSQ_ArenaFree(l->arena, e); \
+	l->size--; \
+	return next; \
+} \
+LSQ_GENERIC_API void Name##_Destroy(Name##T* l){ \
+	Name##NodeT *e = l->head.next, *next = NULL; \
+	while (l->arena == LSQ_ArenaInvalid && e != &l->head) { \
+		next = e->next; \
+		free(e); \
+		e = next; \
+	} \
+	Name##_InitInArena(l, l->arena); \
+}
+
+/* Алгоритмы АВЛ-дерева, общие для LSQ_DEFINE_AVL и avl_tree.c: обход, повороты, балансировка, исключение узла и     *
+ * освобождение узлов без рекурсии. Узел NodeT содержит поля left, right, parent и height, дерево TreeT - поле root. *
+ * Hooks - префикс макросов, через которые реализация следит за изменениями: Hooks##_CHANGING(t, node) вызывается   *
+ * перед изменением ссылок узла node (при node == NULL - корня дерева), Hooks##_LINK(t, link, node) записывает      *
+ * ссылку, Hooks##_ROTATED(t) и Hooks##_STEP(t) отмечают поворот и шаг балансировки. LSQ_AVL_PLAIN - без слежения.  *
+ * Name_Unlink исключает узел и восстанавливает баланс, не освобождая узел. Узел с двумя потомками заменяется своим   *
+ * преемником целиком, без копирования ключа и значения, поэтому указатели на другие узлы остаются верными; узлы на   *
+ * пути к преемнику теряют его ключ и тоже проходят через Hooks##_CHANGING. Name_FreeNodes освобождает не более      *
+ * budget узлов (budget < 0 - все), перенося левое поддерево поворотами вправо, и возвращает 1, если узлов не осталось */
+#define LSQ_AVL_PLAIN_CHANGING(t, node) ((void)0)
+#define LSQ_AVL_PLAIN_LINK(t, link, node) (*(link) = (node))
+#define LSQ_AVL_PLAIN_ROTATED(t) ((void)0)
+#define LSQ_AVL_PLAIN_STEP(t) ((void)0)
+
+#define LSQ_DEFINE_AVL_ALGORITHMS(Name, NodeT, TreeT, Hooks) \
+LSQ_GENERIC_API NodeT* Name##_Minimum(NodeT* node){ \
+	while (node->left != NULL) \
+		node = node->left; \
+	return node; \
+} \
+LSQ_GENERIC_API NodeT* Name##_Maximum(NodeT* node){ \
+	while (node->right != NULL) \
+		node = node->right; \
+	return node; \
+} \
+LSQ_GENERIC_API NodeT* Name##_Next(NodeT* node){ \
+	if (node->right != NULL) \
+		return Name##_Minimum(node->right); \
+	while (node->parent != NULL && node->parent->right == node) \
+		node = node->parent; \
+	return node->parent; \
+} \
+LSQ_GENERIC_API int Name##_Height(NodeT* node){ \
+	return node == NULL ? 0 : node->height; \
+} \
+LSQ_GENERIC_API int Name##_BalanceFactor(NodeT* node){ \
+	return Name##_Height(node->left) - Name##_Height(node->right); \
+} \
+LSQ_GENERIC_API void Name##_RefreshHeight(NodeT* node){ \
+	int left = Name##_Height(node->left), right = Name##_Height(node->right); \
+	node->height = 1 + (left > right ? left : right); \
+} \
+LSQ_GENERIC_API void Name##_ReplaceNode(TreeT* t, NodeT* node, NodeT* new_node){ \
+	if (new_node != NULL) \
+		new_node->parent = node->parent; \
+	Hooks##_CHANGING(t, node->parent); \
+	if (node->parent == NULL) \
+		Hooks##_LINK(t, &t->root, new_node); \
+	else if (node->parent->left == node) \
+		Hooks##_LINK(t, &node->parent->left, new_node); \
+	else \
+		Hooks##_LINK(t, &node->parent->right, new_node); \
+} \
+LSQ_GENERIC_API void Name##_LeftRotate(TreeT* t, NodeT* node){ \
+	NodeT* new_root = node->right; \
+	Hooks##_ROTATED(t); \
+	Hooks##_CHANGING(t, node); \
+	Hooks##_CHANGING(t, new_root); \
+	Name##_ReplaceNode(t, node, new_root); \
+	Hooks##_LINK(t, &node->right, new_root->left); \
+	if (node->right != NULL) \
+		node->right->parent = node; \
+	node->parent = new_root; \
+	Hooks##_LINK(t, &new_root->left, node); \
+	Name##_RefreshHeight(node); \
+	Name##_RefreshHeight(new_root); \
+} \
+LSQ_GENERIC_API void Name##_RightRotate(TreeT* t, NodeT* node){ \
+	NodeT* new_root = node->left; \
+	Hooks##_ROTATED(t); \
+	Hooks##_CHANGING(t, node); \
+	Hooks##_CHANGING(t, new_root); \
+	Name##_ReplaceNode(t, node, new_root); \
+	Hooks##_LINK(t, &node->left, new_root->right); \
+	if (node->left != NULL) \
+		node->left->parent = node; \
+	node->parent = new_root; \
+	Hooks##_LINK(t, &new_root->right, node); \
+	Name##_RefreshHeight(node); \
+	Name##_RefreshHeight(new_root); \
+} \
+LSQ_GENERIC_API void Name##_Balance(TreeT* t, NodeT* node, int stop_criterion){ \
+	NodeT* parent = NULL; \
+	int balance; \
+	while (node != NULL) { \
+		Hooks##_STEP(t); \
+		Name##_RefreshHeight(node); \
+		balance = Name##_BalanceFactor(node); \
+		parent = node->parent; \
+		if (abs(balance) == stop_criterion) \
+			return; \
+		if (balance == -2) { \
+			if (Name##_BalanceFactor(node->right) > 0) \
+				Name##_RightRotate(t, node->right); \
+			Name##_LeftRotate(t, node); \
+		} \
+		else if (balance == 2) { \
+			if (Name##_BalanceFactor(node->left) < 0) \
+				Name##_LeftRotate(t, node->left); \
+			Name##_RightRotate(t, node); \
+		} \
+		node = parent; \
+	} \
+} \
+LSQ_GENERIC_API void Name##_Unlink(TreeT* t, NodeT* node){ \
+	NodeT *next = NULL, *parent = node->parent, *step = NULL; \
+	Hooks##_CHANGING(t, node); \
+	if (node->left == NULL) \
+		Name##_ReplaceNode(t, node, node->right); \
+	else if (node->right == NULL) \
+		Name##_ReplaceNode(t, node, node->left); \
+	else { \
+		next = Name##_Minimum(node->right); \
+		Hooks##_CHANGING(t, next); \
+		for (step = next->parent; step != node; step = step->parent) \
+			Hooks##_CHANGING(t, step); \
+		if (next->parent != node) { \
+			parent = next->parent; \
+			Name##_ReplaceNode(t, next, next->right); \
+			Hooks##_LINK(t, &next->right, node->right); \
+			next->right->parent = next; \
+		} \
+		else \
+			parent = next; \
+		Name##_ReplaceNode(t, node, next); \
+		Hooks##_LINK(t, &next->left, node->left); \
+		next->left->parent = next; \
+		next->height = node->height; \
+	} \
+	Name##_Balance(t, parent, 1); \
+} \
+LSQ_GENERIC_API int Name##_FreeNodes(NodeT** root, long budget){ \
+	NodeT *node = *root, *next = NULL; \
+	while (node != NULL && budget-- != 0) { \
+		if (node->left != NULL) { \
+			next = node->left; \
+			node->left = next->right; \
+			next->right = node; \
+		} \
+		else { \
+			next = node->right; \
+			free(node); \
+		} \
+		node = next; \
+	} \
+	*root = node; \
+	return node == NULL; \
+}
+
+/* АВЛ-дерево с ключами типа K, значениями типа V и порядком, заданным Less(a, b) */
+#define LSQ_DEFINE_AVL(Name, K, V, Less) \
+typedef struct Name##NodeT { \
+	struct Name##NodeT* left; \
+	struct Name##NodeT* right; \
+	struct Name##NodeT* parent; \
+	K key; \
+	V value; \
+	int height; \
+} Name##NodeT; \
+typedef struct { \
+	Name##NodeT* root; \
+	int size; \
+	LSQ_ArenaT arena; \
+} Name##T; \
+LSQ_DEFINE_AVL_ALGORITHMS(Name, Name##NodeT, Name##T, LSQ_AVL_PLAIN) \
+LSQ_GENERIC_API void Name##_InitInArena(Name##T* t, LSQ_ArenaT arena){ \
+	t->root = NULL; \
+	t->size = 0; \
+	t->arena = arena; \
+} \
+LSQ_GENERIC_API void Name##_Init(Name##T* t){ \
+	Name##_InitInArena(t, LSQ_ArenaInvalid); \
+} \
+LSQ_GENERIC_API int Name##_Size(const Name##T* t){ \
+	return t->size; \
+} \
+LSQ_GENERIC_API Name##NodeT* Name##_Find(const Name##T* t, K key){ \
+	Name##NodeT* node = t->root; \
+	while (node != NULL) { \
+		if (Less(key, node->key)) \
+			node = node->left; \
+		else if (Less(node->key, key)) \
+			node = node->right; \
+		else \
+			break; \
+	} \
+	return node; \
+} \
+LSQ_GENERIC_API V* Name##_Get(const Name##T* t, K key){ \
+	Name##NodeT* node = Name##_Find(t, key); \
+	return node != NULL ? &node->value : NULL; \
+} \
+LSQ_GENERIC_API int Name##_Insert(Name##T* t, K key, V value){ \
+	Name##NodeT *parent = NULL, **link = &t->root, *node = NULL; \
+	while (*link != NULL) { \
+		parent = *link; \
+		if (Less(key, parent->key)) \
+			link = &parent->left; \
+		else if (Less(parent->key, key)) \
+			link = &parent->right; \
+		else { \
+			parent->value = value; \
+			return 1; \
+		} \
+	} \
+	node = (Name##NodeT*)LSQ_ArenaMalloc(t->arena, sizeof(Name##NodeT)); \
+	if (node == NULL) \
+		return 0; \
+	node->key = key; \
+	node->value = value; \
+	node->left = NULL; \
+	node->right = NULL; \
+	node->parent = parent; \
+	node->height = 1; \
+	*link = node; \
+	t->size++; \
+	Name##_Balance(t, parent, 0); \
+	return 1; \
+} \
+LSQ_GENERIC_API Name##NodeT* Name##_DeleteNode(Name##T* t, Name##NodeT* node){ \
+	Name##NodeT* next = Name##_Next(node); \
+	Name##_Unlink(t, node); \
+	LSQ_ArenaFree(t->arena, node); \
+	t->size--; \
+	return next; \
+} \
+LSQ_GENERIC_API int Name##_Delete(Name##T* t, K key){ \
+	Name##NodeT* node = Name##_Find(t, key); \
+	if (node == NULL) \
+		return 0; \
+	Name##_DeleteNode(t, node); \
+	return 1; \
+} \
+LSQ_GENERIC_API Name##NodeT* Name##_First(const Name##T* t){ \
+	return t->root != NULL ? Name##_Minimum(t->root) : NULL; \
+} \
+LSQ_GENERIC_API void Name##_Destroy(Name##T* t){ \
+	if (t->arena == LSQ_ArenaInvalid) \
+		Name##_FreeNodes(&t->root, -1); \
+	Name##_InitInArena(t, t->arena); \
+}
+
+#endif
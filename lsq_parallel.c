@@ -0,0 +1,120 @@
+#include "lsq_parallel.h"
+#include "lsq_stats.h"
+#include <stdlib.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#define PARALLEL_CACHE_LINE 64
+
+typedef struct {
+	int next;
+	int end;
+	char padding[PARALLEL_CACHE_LINE - 2 * sizeof(int)];
+}	WorkRangeT;
+
+typedef struct {
+	pthread_mutex_t lock;
+	pthread_cond_t start;
+	pthread_cond_t done;
+	pthread_mutex_t callers;
+	LSQ_ParallelTaskT task;
+	void* arg;
+	unsigned long generation;
+	int active;
+	int threads;
+	WorkRangeT ranges[LSQ_PARALLEL_MAX_THREADS];
+}	PoolT;
+
+static PoolT pool;
+static pthread_once_t pool_once = PTHREAD_ONCE_INIT;
+static int requested_threads = 0;
+static LSQ_THREAD_LOCAL int inside_task = 0;
+
+static void RunRanges(int worker){
+	int i, victim, index;
+	for (i = 0; i < pool.threads; i++) {
+		victim = (worker + i) % pool.threads;
+		while ((index = __atomic_fetch_add(&pool.ranges[victim].next, 1, __ATOMIC_RELAXED)) < pool.ranges[victim].end)
+			pool.task(index, pool.arg);
+	}
+}
+
+static void* Worker(void* arg){
+	int worker = (int)(long)arg;
+	unsigned long seen = 0;
+	inside_task = 1;
+	pthread_mutex_lock(&pool.lock);
+	while (1) {
+		while (pool.generation == seen)
+			pthread_cond_wait(&pool.start, &pool.lock);
+		seen = pool.generation;
+		pthread_mutex_unlock(&pool.lock);
+		RunRanges(worker);
+		pthread_mutex_lock(&pool.lock);
+		if (--pool.active == 0)
+			pthread_cond_signal(&pool.done);
+	}
+	return NULL;
+}
+
+static void StartPool(void){
+	pthread_t thread;
+	long i, threads = requested_threads;
+	if (threads <= 0)
+		threads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (threads <= 0)
+		threads = 1;
+	if (threads > LSQ_PARALLEL_MAX_THREADS)
+		threads = LSQ_PARALLEL_MAX_THREADS;
+	pthread_mutex_init(&pool.lock, NULL);
+	pthread_cond_init(&pool.start, NULL);
+	pthread_cond_init(&pool.done, NULL);
+	pthread_mutex_init(&pool.callers, NULL);
+	pool.threads = 1;
+	for (i = 1; i < threads; i++) {
+		if (pthread_create(&thread, NULL, Worker, (void*)i) != 0)
+			break;
+		pthread_detach(thread);
+		pool.threads++;
+	}
+}
+
+extern void LSQ_SetParallelThreads(int threads){
+	requested_threads = threads;
+}
+
+extern int LSQ_GetParallelThreads(void){
+	pthread_once(&pool_once, StartPool);
+	return pool.threads;
+}
+
+extern void LSQ_ParallelRun(LSQ_ParallelTaskT task, void* arg, int count){
+	int i;
+	if (task == NULL || count <= 0)
+		return;
+	if (inside_task || count == 1 || LSQ_GetParallelThreads() == 1) {
+		for (i = 0; i < count; i++)
+			task(i, arg);
+		return;
+	}
+	pthread_mutex_lock(&pool.callers);
+	pthread_mutex_lock(&pool.lock);
+	pool.task = task;
+	pool.arg = arg;
+	for (i = 0; i < pool.threads; i++) {
+		pool.ranges[i].next = (int)((long long)count * i / pool.threads);
+		pool.ranges[i].end = (int)((long long)count * (i + 1) / pool.threads);
+	}
+	pool.active = pool.threads - 1;
+	pool.generation++;
+	pthread_cond_broadcast(&pool.start);
+	pthread_mutex_unlock(&pool.lock);
+	inside_task = 1;
+	RunRanges(0);
+	inside_task = 0;
+	pthread_mutex_lock(&pool.lock);
+	while (pool.active > 0)
+		pthread_cond_wait(&pool.done, &pool.lock);
+	pthread_mutex_unlock(&pool.lock);
+	pthread_mutex_unlock(&pool.callers);
+}
@@ -0,0 +1,24 @@
+#ifndef LSQ_PARALLEL_H
+#define LSQ_PARALLEL_H
+
+/* Пул потоков для параллельной обработки контейнеров. Задачи 0..count-1 делятся между потоками поровну; поток,   *
+ * закончивший свою часть, забирает оставшиеся задачи у других. Вызывающий поток участвует в работе и возвращается *
+ * после завершения всех задач.                                                                                   */
+
+#define LSQ_PARALLEL_MAX_THREADS 64
+#define LSQ_PARALLEL_CHUNK 4096
+
+typedef void (*LSQ_ParallelTaskT)(int index, void* arg);
+
+/* Функция, задающая число потоков пула (по умолчанию - число процессоров). Вызывается до первой параллельной    *
+ * операции.                                                                                                      */
+extern void LSQ_SetParallelThreads(int threads);
+
+/* Функция, возвращающая число потоков, между которыми делится работа */
+extern int LSQ_GetParallelThreads(void);
+
+/* Функция, выполняющая task(index, arg) для всех index от 0 до count-1. Вызов из задачи выполняется             *
+ * последовательно.                                                                                               */
+extern void LSQ_ParallelRun(LSQ_ParallelTaskT task, void* arg, int count);
+
+#endif
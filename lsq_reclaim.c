@@ -0,0 +1,75 @@
+#include "lsq_reclaim.h"
+#include <stdlib.h>
+#include <pthread.h>
+
+typedef struct ReclaimItemT {
+	void* handle;
+	LSQ_ReclaimStepT step;
+	struct ReclaimItemT* next;
+}	ReclaimItemT, *ReclaimItemPtrT;
+
+static pthread_mutex_t reclaim_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t reclaim_ready = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t reclaim_idle = PTHREAD_COND_INITIALIZER;
+static ReclaimItemPtrT queue_front = NULL;
+static ReclaimItemPtrT queue_rear = NULL;
+static int busy = 0;
+static int started = 0;
+
+static void* Reclaimer(void* arg){
+	ReclaimItemPtrT item = NULL;
+	pthread_mutex_lock(&reclaim_lock);
+	while (1) {
+		while (queue_front == NULL)
+			pthread_cond_wait(&reclaim_ready, &reclaim_lock);
+		item = queue_front;
+		queue_front = item->next;
+		if (queue_front == NULL)
+			queue_rear = NULL;
+		busy = 1;
+		pthread_mutex_unlock(&reclaim_lock);
+		while (!item->step(item->handle, LSQ_RECLAIM_BUDGET));
+		free(item);
+		pthread_mutex_lock(&reclaim_lock);
+		busy = 0;
+		if (queue_front == NULL)
+			pthread_cond_broadcast(&reclaim_idle);
+	}
+	return arg;
+}
+
+extern void LSQ_ReclaimInBackground(void* handle, LSQ_ReclaimStepT step){
+	ReclaimItemPtrT item = NULL;
+	pthread_t thread;
+	if (handle == NULL || step == NULL)
+		return;
+	item = (ReclaimItemPtrT)malloc(sizeof(ReclaimItemT));
+	pthread_mutex_lock(&reclaim_lock);
+	if (!started && pthread_create(&thread, NULL, Reclaimer, NULL) == 0) {
+		pthread_detach(thread);
+		started = 1;
+	}
+	if (item == NULL || !started) {
+		pthread_mutex_unlock(&reclaim_lock);
+		free(item);
+		while (!step(handle, LSQ_RECLAIM_BUDGET));
+		return;
+	}
+	item->handle = handle;
+	item->step = step;
+	item->next = NULL;
+	if (queue_rear != NULL)
+		queue_rear->next = item;
+	else
+		queue_front = item;
+	queue_rear = item;
+	pthread_cond_signal(&reclaim_ready);
+	pthread_mutex_unlock(&reclaim_lock);
+}
+
+extern void LSQ_WaitForReclaimer(void){
+	pthread_mutex_lock(&reclaim_lock);
+	while (queue_front != NULL || busy)
+		pthread_cond_wait(&reclaim_idle, &reclaim_lock);
+	pthread_mutex_unlock(&reclaim_lock);
+}
@@ -0,0 +1,18 @@
+#ifndef LSQ_RECLAIM_H
+#define LSQ_RECLAIM_H
+
+/* Фоновое уничтожение контейнеров. Контейнер передаётся отдельному потоку вместе с функцией step, которая         *
+ * освобождает не более budget элементов и возвращает 1, когда контейнер уничтожен полностью.                      */
+
+#define LSQ_RECLAIM_BUDGET 4096
+
+typedef int (*LSQ_ReclaimStepT)(void* handle, int budget);
+
+/* Функция, ставящая контейнер в очередь на фоновое уничтожение. Если поток запустить не удалось, контейнер      *
+ * уничтожается сразу в вызывающем потоке.                                                                         */
+extern void LSQ_ReclaimInBackground(void* handle, LSQ_ReclaimStepT step);
+
+/* Функция, дожидающаяся уничтожения всех переданных в фоновый поток контейнеров */
+extern void LSQ_WaitForReclaimer(void);
+
+#endif
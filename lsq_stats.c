@@ -0,0 +1,107 @@
+#include "lsq_stats.h"
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#define STATS_FIELDS (sizeof(LSQ_StatsT) / sizeof(unsigned long long))
+
+typedef struct StatsThreadT {
+	LSQ_StatsT* stats;
+	struct StatsThreadT* prev;
+	struct StatsThreadT* next;
+}	StatsThreadT, *StatsThreadPtrT;
+
+LSQ_THREAD_LOCAL LSQ_StatsT LSQ_Stats;
+LSQ_THREAD_LOCAL int LSQ_StatsRegistered;
+
+static LSQ_THREAD_LOCAL StatsThreadT self;
+static pthread_mutex_t registry_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t registry_once = PTHREAD_ONCE_INIT;
+static pthread_key_t registry_key;
+static StatsThreadPtrT threads = NULL;
+static LSQ_StatsT finished;
+
+static void AddStats(LSQ_StatsT* total, LSQ_StatsT* stats){
+	unsigned long long* to = (unsigned long long*)total;
+	unsigned long long* from = (unsigned long long*)stats;
+	size_t i;
+	for (i = 0; i < STATS_FIELDS; i++)
+		to[i] += __atomic_load_n(&from[i], __ATOMIC_RELAXED);
+}
+
+/* Завершающийся поток переносит свои счётчики в общую сумму finished и исключается из списка */
+static void UnregisterThread(void* arg){
+	StatsThreadPtrT thread = (StatsThreadPtrT)arg;
+	pthread_mutex_lock(&registry_lock);
+	AddStats(&finished, thread->stats);
+	if (thread->prev != NULL)
+		thread->prev->next = thread->next;
+	else
+		threads = thread->next;
+	if (thread->next != NULL)
+		thread->next->prev = thread->prev;
+	pthread_mutex_unlock(&registry_lock);
+}
+
+static void CreateRegistryKey(void){
+	pthread_key_create(&registry_key, UnregisterThread);
+}
+
+extern int LSQ_StatsRegisterThread(void){
+	pthread_once(&registry_once, CreateRegistryKey);
+	self.stats = &LSQ_Stats;
+	self.prev = NULL;
+	pthread_mutex_lock(&registry_lock);
+	self.next = threads;
+	if (threads != NULL)
+		threads->prev = &self;
+	threads = &self;
+	pthread_mutex_unlock(&registry_lock);
+	pthread_setspecific(registry_key, &self);
+	LSQ_StatsRegistered = 1;
+	return 1;
+}
+
+extern void LSQ_GetStats(LSQ_StatsT* stats){
+	if (stats != NULL)
+		memcpy(stats, &LSQ_Stats, sizeof(LSQ_StatsT));
+}
+
+extern void LSQ_GetAllStats(LSQ_StatsT* stats){
+	StatsThreadPtrT thread = NULL;
+	if (stats == NULL)
+		return;
+	pthread_mutex_lock(&registry_lock);
+	memcpy(stats, &finished, sizeof(LSQ_StatsT));
+	for (thread = threads; thread != NULL; thread = thread->next)
+		AddStats(stats, thread->stats);
+	pthread_mutex_unlock(&registry_lock);
+}
+
+extern void LSQ_ResetStats(void){
+	unsigned long long* counters = (unsigned long long*)&LSQ_Stats;
+	size_t i;
+	for (i = 0; i < STATS_FIELDS; i++)
+		__atomic_store_n(&counters[i], 0, __ATOMIC_RELAXED);
+}
+
+extern unsigned long long LSQ_StatsClock(void){
+#if defined(CLOCK_MONOTONIC)
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (unsigned long long)now.tv_sec * 1000000000ULL + now.tv_nsec;
+#else
+	return (unsigned long long)clock() * (1000000000ULL / CLOCKS_PER_SEC);
+#endif
+}
+
+extern void LSQ_StatsRecordLatency(unsigned long long start){
+	unsigned long long elapsed = LSQ_StatsClock() - start;
+	int bucket = 0;
+	while (elapsed > 1 && bucket < LSQ_STATS_LATENCY_BUCKETS - 1) {
+		elapsed >>= 1;
+		bucket++;
+	}
+	LSQ_STAT_ADD(operations, 1);
+	LSQ_STAT_ADD(latency[bucket], 1);
+}
@@ -0,0 +1,63 @@
+#ifndef LSQ_STATS_H
+#define LSQ_STATS_H
+
+/* Счётчики и гистограммы задержек контейнеров. Собираются только при сборке с LSQ_ENABLE_STATS, хранятся        *
+ * отдельно для каждого потока, поэтому на горячем пути нет ни блокировок, ни атомарных операций.                  */
+
+#if defined(_MSC_VER)
+#define LSQ_THREAD_LOCAL __declspec(thread)
+#else
+#define LSQ_THREAD_LOCAL __thread
+#endif
+
+#define LSQ_STATS_LATENCY_BUCKETS 32
+
+typedef struct {
+	unsigned long long operations;
+	unsigned long long reallocs;
+	unsigned long long bytes_moved;
+	unsigned long long node_allocations;
+	unsigned long long traversal_steps;
+	unsigned long long rotations;
+	unsigned long long descent_depth;
+	unsigned long long rebalance_steps;
+	/* latency[i] - число операций, длившихся от 2^i до 2^(i+1) наносекунд */
+	unsigned long long latency[LSQ_STATS_LATENCY_BUCKETS];
+}	LSQ_StatsT;
+
+extern LSQ_THREAD_LOCAL LSQ_StatsT LSQ_Stats;
+
+/* Признак того, что счётчики потока внесены в общий список (см. LSQ_GetAllStats) */
+extern LSQ_THREAD_LOCAL int LSQ_StatsRegistered;
+
+/* Функция, копирующая в stats статистику вызывающего потока */
+extern void LSQ_GetStats(LSQ_StatsT* stats);
+
+/* Функция, копирующая в stats сумму статистики всех потоков процесса, включая завершившиеся: рабочих потоков  *
+ * lsq_parallel, потоков журнала и фонового уничтожения                                                         */
+extern void LSQ_GetAllStats(LSQ_StatsT* stats);
+
+/* Функция, обнуляющая статистику вызывающего потока */
+extern void LSQ_ResetStats(void);
+
+/* Функция, вносящая счётчики вызывающего потока в общий список. Вызывается макросами при первом обращении */
+extern int LSQ_StatsRegisterThread(void);
+
+extern unsigned long long LSQ_StatsClock(void);
+
+extern void LSQ_StatsRecordLatency(unsigned long long start);
+
+#ifdef LSQ_ENABLE_STATS
+/* Счётчик меняет только его поток, поэтому достаточно атомарной записи без блокировки шины: её видит          *
+ * LSQ_GetAllStats, вызванная из другого потока                                                                   */
+#define LSQ_STAT_ADD(counter, amount) ((void)(LSQ_StatsRegistered || LSQ_StatsRegisterThread()), \
+	__atomic_store_n(&LSQ_Stats.counter, LSQ_Stats.counter + (amount), __ATOMIC_RELAXED))
+#define LSQ_STAT_TIMER(name) unsigned long long name = LSQ_StatsClock()
+#define LSQ_STAT_LATENCY(name) LSQ_StatsRecordLatency(name)
+#else
+#define LSQ_STAT_ADD(counter, amount) ((void)0)
+#define LSQ_STAT_TIMER(name) int name = 0
+#define LSQ_STAT_LATENCY(name) ((void)(name))
+#endif
+
+#endif